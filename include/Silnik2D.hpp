@@ -0,0 +1,6777 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <SFML/Window.hpp>
+#include <SFML/System.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <array>
+#include <memory>
+#include <algorithm>
+#include <set>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <limits>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SILNIK2D_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define SILNIK2D_NEON 1
+#include <arm_neon.h>
+#endif
+
+// File mapping for SceneFile.
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// GCC and Clang need per-function targets to emit SSE2/AVX2 code without
+// raising the baseline of the whole build; MSVC does not.
+#if defined(SILNIK2D_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SILNIK2D_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SILNIK2D_TARGET(isa)
+#endif
+
+class SpriteBatch;
+class RenderQueue;
+
+class DrawableObject {
+public:
+    virtual ~DrawableObject() = default;
+    virtual void draw(sf::RenderTarget& target) = 0;
+
+    // Objects that can be batched add themselves and return true; the
+    // rest are drawn individually.
+    virtual bool submit(SpriteBatch&) { return false; }
+
+    // Objects that can express their drawing as queued commands record
+    // them and return true.
+    virtual bool record(RenderQueue&) { return false; }
+};
+
+class UpdatableObject {
+public:
+    virtual ~UpdatableObject() = default;
+    virtual void update(float dt) = 0;
+};
+
+class TransformableObject {
+public:
+    virtual ~TransformableObject() = default;
+    virtual void translate(float dx, float dy) = 0;
+    virtual void rotate(float angleDeg) = 0;
+    virtual void scale(float sx, float sy) = 0;
+};
+
+struct Contact;
+
+class GameObject : public virtual UpdatableObject, public virtual DrawableObject {
+public:
+    virtual ~GameObject() = default;
+
+    // Called by CollisionWorld when a collider owned by this object starts
+    // or stops touching another one.
+    virtual void onContact(const Contact&) {}
+};
+
+enum class ContactPhase { Begin, End };
+
+struct Contact {
+    ContactPhase phase;
+    int body;
+    int otherBody;
+    GameObject* other;
+};
+
+// Per-frame section timings and draw counters. ProfileScope adds the time
+// of a block to a named section; nested sections each count their full
+// duration. endFrame() folds the frame into a rolling history for
+// min/avg/p99 and, while capturing, every scope is also kept as a Chrome
+// trace event (chrome://tracing, ui.perfetto.dev). Section names must be
+// string literals or otherwise outlive the profiler.
+class Profiler {
+public:
+    static constexpr std::size_t HistoryFrames = 240;
+
+    struct Stats {
+        float last{ 0.f };
+        float min{ 0.f };
+        float avg{ 0.f };
+        float p99{ 0.f };
+    };
+
+    struct Section {
+        explicit Section(const char* n) : name(n) { history.reserve(HistoryFrames); }
+
+        const char* name;
+        sf::Int64 frameUs{ 0 };
+        std::vector<float> history;
+        std::size_t cursor{ 0 };
+        Stats stats;
+    };
+
+private:
+    struct TraceEvent {
+        const char* name;
+        sf::Int64 start;
+        sf::Int64 duration;
+        unsigned thread;
+    };
+
+    sf::Clock m_clock;
+    std::mutex m_mutex;
+    bool m_enabled{ true };
+
+    std::vector<Section> m_sections;
+    std::unordered_map<const char*, std::size_t> m_index;
+    sf::Int64 m_frameStart{ 0 };
+    Section m_frame{ "frame" };
+
+    std::size_t m_drawCalls{ 0 };
+    std::size_t m_vertices{ 0 };
+    std::size_t m_lastDrawCalls{ 0 };
+    std::size_t m_lastVertices{ 0 };
+
+    bool m_capturing{ false };
+    std::size_t m_traceLimit{ 0 };
+    std::vector<TraceEvent> m_trace;
+    std::vector<std::thread::id> m_threads;
+
+    // Reused every frame so folding and the overlay do not allocate.
+    std::vector<float> m_scratch;
+    mutable std::vector<sf::Vertex> m_overlay;
+
+    Section& section(const char* name) {
+        auto it = m_index.find(name);
+        if (it != m_index.end())
+            return m_sections[it->second];
+        // Equal literals are not guaranteed to share an address.
+        for (std::size_t i = 0; i < m_sections.size(); ++i)
+            if (std::strcmp(m_sections[i].name, name) == 0) {
+                m_index[name] = i;
+                return m_sections[i];
+            }
+        m_index[name] = m_sections.size();
+        m_sections.push_back(Section(name));
+        return m_sections.back();
+    }
+
+    unsigned threadIndex(std::thread::id id) {
+        for (std::size_t i = 0; i < m_threads.size(); ++i)
+            if (m_threads[i] == id)
+                return (unsigned)i;
+        m_threads.push_back(id);
+        return (unsigned)m_threads.size() - 1;
+    }
+
+    static void fold(Section& s, float ms, std::vector<float>& scratch) {
+        if (s.history.size() < HistoryFrames)
+            s.history.push_back(ms);
+        else
+            s.history[s.cursor] = ms;
+        s.cursor = (s.cursor + 1) % HistoryFrames;
+
+        s.stats.last = ms;
+        s.stats.min = *std::min_element(s.history.begin(), s.history.end());
+        float sum = 0.f;
+        for (float v : s.history)
+            sum += v;
+        s.stats.avg = sum / s.history.size();
+        scratch.reserve(HistoryFrames);
+        scratch.assign(s.history.begin(), s.history.end());
+        std::size_t k = (scratch.size() * 99) / 100;
+        if (k >= scratch.size())
+            k = scratch.size() - 1;
+        std::nth_element(scratch.begin(), scratch.begin() + k, scratch.end());
+        s.stats.p99 = scratch[k];
+    }
+
+public:
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+
+    sf::Int64 now() const { return m_clock.getElapsedTime().asMicroseconds(); }
+
+    void beginFrame() {
+        m_frameStart = now();
+    }
+
+    void endFrame() {
+        if (!m_enabled)
+            return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        sf::Int64 end = now();
+        m_frame.frameUs = end - m_frameStart;
+        fold(m_frame, m_frame.frameUs / 1000.f, m_scratch);
+        for (Section& s : m_sections) {
+            fold(s, s.frameUs / 1000.f, m_scratch);
+            s.frameUs = 0;
+        }
+        if (m_capturing && m_trace.size() < m_traceLimit)
+            m_trace.push_back(TraceEvent{ "frame", m_frameStart, end - m_frameStart,
+                threadIndex(std::this_thread::get_id()) });
+
+        m_lastDrawCalls = m_drawCalls;
+        m_lastVertices = m_vertices;
+        m_drawCalls = 0;
+        m_vertices = 0;
+    }
+
+    void record(const char* name, sf::Int64 start, sf::Int64 end) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        section(name).frameUs += end - start;
+        if (m_capturing && m_trace.size() < m_traceLimit)
+            m_trace.push_back(TraceEvent{ name, start, end - start,
+                threadIndex(std::this_thread::get_id()) });
+    }
+
+    void countDraw(std::size_t vertices, std::size_t calls = 1) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_drawCalls += calls;
+        m_vertices += vertices;
+    }
+
+    // Counters of the last completed frame.
+    std::size_t drawCalls() const { return m_lastDrawCalls; }
+    std::size_t vertices() const { return m_lastVertices; }
+
+    const Stats& frameStats() const { return m_frame.stats; }
+    const std::vector<Section>& sections() const { return m_sections; }
+
+    Stats stats(const char* name) const {
+        for (const Section& s : m_sections)
+            if (std::strcmp(s.name, name) == 0)
+                return s.stats;
+        return Stats();
+    }
+
+    void startCapture(std::size_t maxEvents = 1u << 20) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_trace.clear();
+        m_traceLimit = maxEvents;
+        m_capturing = true;
+    }
+
+    void stopCapture() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capturing = false;
+    }
+
+    bool capturing() const { return m_capturing; }
+    std::size_t capturedEvents() const { return m_trace.size(); }
+
+    bool writeChromeTrace(const std::string& path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::FILE* f = std::fopen(path.c_str(), "w");
+        if (!f)
+            return false;
+        std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+        for (std::size_t i = 0; i < m_trace.size(); ++i) {
+            const TraceEvent& e = m_trace[i];
+            std::fprintf(f, "%s\n{\"name\":\"", i ? "," : "");
+            for (const char* c = e.name; *c; ++c) {
+                if (*c == '"' || *c == '\\')
+                    std::fputc('\\', f);
+                std::fputc(*c, f);
+            }
+            std::fprintf(f, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld}",
+                e.thread, (long long)e.start, (long long)e.duration);
+        }
+        std::fputs("\n]}\n", f);
+        return std::fclose(f) == 0;
+    }
+
+    // One row per section: a bar for the average, a tick at p99 and a
+    // marker at the 60 Hz budget. Labels need a font; without one the
+    // rows are in first-use order with the frame total on top.
+    void drawOverlay(sf::RenderTarget& target, sf::Vector2f origin,
+        const sf::Font* font = nullptr) const {
+        const float rowH = 14.f;
+        const float labelW = font ? 110.f : 0.f;
+        const float pxPerMs = 12.f;
+        const float budgetMs = 1000.f / 60.f;
+        const std::size_t rows = m_sections.size() + 1;
+        const float width = labelW + budgetMs * pxPerMs * 1.5f + 8.f;
+
+        std::vector<sf::Vertex>& quads = m_overlay;
+        quads.clear();
+        auto rect = [&quads](float x, float y, float w, float h, sf::Color c) {
+            sf::Vector2f a(x, y), b(x + w, y), d(x + w, y + h), e(x, y + h);
+            quads.insert(quads.end(), { sf::Vertex(a, c), sf::Vertex(b, c), sf::Vertex(d, c),
+                sf::Vertex(a, c), sf::Vertex(d, c), sf::Vertex(e, c) });
+        };
+
+        rect(origin.x, origin.y, width, rows * rowH + 4.f, sf::Color(0, 0, 0, 160));
+        float x0 = origin.x + 4.f + labelW;
+        for (std::size_t i = 0; i < rows; ++i) {
+            const Stats& st = i == 0 ? m_frame.stats : m_sections[i - 1].stats;
+            float y = origin.y + 2.f + i * rowH;
+            sf::Color c = i == 0 ? sf::Color(120, 200, 255) : sf::Color(120, 230, 120);
+            if (st.avg > budgetMs)
+                c = sf::Color(240, 90, 90);
+            rect(x0, y + 2.f, std::min(st.avg, budgetMs * 1.5f) * pxPerMs, rowH - 4.f, c);
+            rect(x0 + std::min(st.p99, budgetMs * 1.5f) * pxPerMs, y, 2.f, rowH, sf::Color::White);
+        }
+        rect(x0 + budgetMs * pxPerMs, origin.y, 1.f, rows * rowH + 4.f, sf::Color::Yellow);
+        target.draw(quads.data(), quads.size(), sf::Triangles);
+
+        if (!font)
+            return;
+        char buf[128];
+        sf::Text text;
+        text.setFont(*font);
+        text.setCharacterSize(10);
+        text.setFillColor(sf::Color::White);
+        for (std::size_t i = 0; i < rows; ++i) {
+            const char* name = i == 0 ? "frame" : m_sections[i - 1].name;
+            const Stats& st = i == 0 ? m_frame.stats : m_sections[i - 1].stats;
+            std::snprintf(buf, sizeof(buf), "%s %.2f/%.2f/%.2f", name, st.min, st.avg, st.p99);
+            text.setString(buf);
+            text.setPosition(origin.x + 4.f, origin.y + 1.f + i * rowH);
+            target.draw(text);
+        }
+        std::snprintf(buf, sizeof(buf), "draws %u  verts %u",
+            (unsigned)m_lastDrawCalls, (unsigned)m_lastVertices);
+        text.setString(buf);
+        text.setPosition(origin.x + 4.f, origin.y + 4.f + rows * rowH);
+        target.draw(text);
+    }
+};
+
+// Records the enclosing block into a profiler section; a null profiler
+// makes it a no-op.
+class ProfileScope {
+    Profiler* m_profiler;
+    const char* m_name;
+    sf::Int64 m_start{ 0 };
+public:
+    ProfileScope(Profiler* profiler, const char* name)
+        : m_profiler(profiler && profiler->enabled() ? profiler : nullptr), m_name(name) {
+        if (m_profiler)
+            m_start = m_profiler->now();
+    }
+
+    ~ProfileScope() {
+        if (m_profiler)
+            m_profiler->record(m_name, m_start, m_profiler->now());
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+// Linear allocator for data that lives at most one frame. Allocation
+// bumps an offset inside the current block; reset() rewinds everything at
+// once and, if the frame spilled into several blocks, replaces them with
+// one block of the combined size, so a steady workload settles into a
+// single block and no heap traffic. Single-threaded: use it from the main
+// thread only.
+class FrameArena {
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Block> m_blocks;
+    std::size_t m_blockSize;
+    std::size_t m_current{ 0 };
+    std::size_t m_offset{ 0 };
+    std::size_t m_used{ 0 };
+    std::size_t m_peak{ 0 };
+
+    void addBlock(std::size_t size) {
+        Block b;
+        b.data.reset(new unsigned char[size]);
+        b.size = size;
+        m_blocks.push_back(std::move(b));
+    }
+
+public:
+    explicit FrameArena(std::size_t blockSize = 256 * 1024)
+        : m_blockSize(blockSize) {
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(std::size_t bytes, std::size_t align) {
+        while (true) {
+            if (m_current < m_blocks.size()) {
+                Block& b = m_blocks[m_current];
+                std::uintptr_t base = (std::uintptr_t)b.data.get();
+                std::size_t start = (std::size_t)(((base + m_offset + align - 1) & ~(std::uintptr_t)(align - 1)) - base);
+                if (start + bytes <= b.size) {
+                    m_offset = start + bytes;
+                    m_used += bytes;
+                    m_peak = std::max(m_peak, m_used);
+                    return b.data.get() + start;
+                }
+                ++m_current;
+                m_offset = 0;
+                continue;
+            }
+            addBlock(std::max(m_blockSize, bytes + align));
+        }
+    }
+
+    void reset() {
+        if (m_blocks.size() > 1 && m_current > 0) {
+            std::size_t total = 0;
+            for (const Block& b : m_blocks)
+                total += b.size;
+            m_blocks.clear();
+            addBlock(total);
+        }
+        m_current = 0;
+        m_offset = 0;
+        m_used = 0;
+    }
+
+    std::size_t usedBytes() const { return m_used; }
+    std::size_t peakBytes() const { return m_peak; }
+
+    std::size_t capacity() const {
+        std::size_t total = 0;
+        for (const Block& b : m_blocks)
+            total += b.size;
+        return total;
+    }
+};
+
+// Standard allocator over a FrameArena; without an arena it uses the
+// heap, so code can take one allocator type either way. Arena memory is
+// never freed individually.
+template <typename T>
+class ArenaAllocator {
+    template <typename U> friend class ArenaAllocator;
+    FrameArena* m_arena;
+public:
+    typedef T value_type;
+
+    ArenaAllocator(FrameArena* arena = nullptr) : m_arena(arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.m_arena) {}
+
+    T* allocate(std::size_t n) {
+        if (m_arena)
+            return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t) {
+        if (!m_arena)
+            ::operator delete(p);
+    }
+
+    FrameArena* arena() const { return m_arena; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& o) const { return m_arena == o.m_arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& o) const { return m_arena != o.m_arena; }
+};
+
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+class SpatialObject;
+
+// Uniform grid over world-space bounds. Each proxy is listed in every cell
+// its bounds touch; moving within the same cell range only updates the
+// stored rect. Edits are locked so objects may move during the parallel
+// update phase; queries are not, and belong outside it.
+class SpatialGrid {
+public:
+    typedef int Proxy;
+
+private:
+    struct Entry {
+        SpatialObject* object{ nullptr };
+        sf::FloatRect bounds;
+        int x0{ 0 }, y0{ 0 }, x1{ -1 }, y1{ -1 };
+        unsigned stamp{ 0 };
+    };
+
+    float m_cellSize;
+    std::mutex m_mutex;
+    std::unordered_map<std::int64_t, std::vector<Proxy>> m_cells;
+    std::vector<Entry> m_entries;
+    std::vector<Proxy> m_free;
+    std::size_t m_count{ 0 };
+    mutable unsigned m_stamp{ 0 };
+
+    // Extent of every cell ever used, bounds the nearest() ring search.
+    int m_minX{ 0 }, m_minY{ 0 }, m_maxX{ -1 }, m_maxY{ -1 };
+
+    static std::int64_t key(int cx, int cy) {
+        return (std::int64_t)((std::uint64_t)(std::uint32_t)cx << 32 | (std::uint32_t)cy);
+    }
+
+    int cellOf(float v) const { return (int)std::floor(v / m_cellSize); }
+
+    // Closed-interval overlap, so zero-sized bounds (points) still match.
+    static bool overlaps(const sf::FloatRect& a, const sf::FloatRect& b) {
+        return a.left <= b.left + b.width && b.left <= a.left + a.width &&
+            a.top <= b.top + b.height && b.top <= a.top + a.height;
+    }
+
+    static float distanceSq(const sf::FloatRect& r, const sf::Vector2f& p) {
+        float dx = std::max(std::max(r.left - p.x, 0.f), p.x - (r.left + r.width));
+        float dy = std::max(std::max(r.top - p.y, 0.f), p.y - (r.top + r.height));
+        return dx * dx + dy * dy;
+    }
+
+    void link(Proxy id) {
+        Entry& e = m_entries[id];
+        e.x0 = cellOf(e.bounds.left);
+        e.y0 = cellOf(e.bounds.top);
+        e.x1 = cellOf(e.bounds.left + e.bounds.width);
+        e.y1 = cellOf(e.bounds.top + e.bounds.height);
+        for (int cy = e.y0; cy <= e.y1; ++cy)
+            for (int cx = e.x0; cx <= e.x1; ++cx)
+                m_cells[key(cx, cy)].push_back(id);
+
+        if (m_maxX < m_minX) {
+            m_minX = e.x0; m_minY = e.y0; m_maxX = e.x1; m_maxY = e.y1;
+        }
+        else {
+            m_minX = std::min(m_minX, e.x0); m_minY = std::min(m_minY, e.y0);
+            m_maxX = std::max(m_maxX, e.x1); m_maxY = std::max(m_maxY, e.y1);
+        }
+    }
+
+    void unlink(Proxy id) {
+        const Entry& e = m_entries[id];
+        for (int cy = e.y0; cy <= e.y1; ++cy)
+            for (int cx = e.x0; cx <= e.x1; ++cx) {
+                auto it = m_cells.find(key(cx, cy));
+                if (it == m_cells.end())
+                    continue;
+                std::vector<Proxy>& ids = it->second;
+                auto pos = std::find(ids.begin(), ids.end(), id);
+                if (pos != ids.end()) {
+                    *pos = ids.back();
+                    ids.pop_back();
+                }
+                if (ids.empty())
+                    m_cells.erase(it);
+            }
+    }
+
+    bool valid(Proxy id) const {
+        return id >= 0 && (std::size_t)id < m_entries.size() && m_entries[id].object;
+    }
+
+public:
+    explicit SpatialGrid(float cellSize = 128.f)
+        : m_cellSize(cellSize > 0.f ? cellSize : 128.f) {
+    }
+
+    SpatialGrid(const SpatialGrid&) = delete;
+    SpatialGrid& operator=(const SpatialGrid&) = delete;
+
+    float cellSize() const { return m_cellSize; }
+    std::size_t size() const { return m_count; }
+
+    Proxy insert(SpatialObject* object, const sf::FloatRect& bounds) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Proxy id;
+        if (!m_free.empty()) {
+            id = m_free.back();
+            m_free.pop_back();
+        }
+        else {
+            id = (Proxy)m_entries.size();
+            m_entries.emplace_back();
+        }
+        m_entries[id].object = object;
+        m_entries[id].bounds = bounds;
+        link(id);
+        ++m_count;
+        return id;
+    }
+
+    void update(Proxy id, const sf::FloatRect& bounds) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!valid(id))
+            return;
+        Entry& e = m_entries[id];
+        e.bounds = bounds;
+        if (cellOf(bounds.left) == e.x0 && cellOf(bounds.top) == e.y0 &&
+            cellOf(bounds.left + bounds.width) == e.x1 &&
+            cellOf(bounds.top + bounds.height) == e.y1)
+            return;
+        unlink(id);
+        link(id);
+    }
+
+    void remove(Proxy id) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!valid(id))
+            return;
+        unlink(id);
+        m_entries[id] = Entry();
+        m_free.push_back(id);
+        --m_count;
+    }
+
+    const sf::FloatRect& bounds(Proxy id) const { return m_entries[id].bounds; }
+
+    // Calls fn(SpatialObject*) once for every object whose bounds overlap
+    // the region.
+    template <typename Fn>
+    void query(const sf::FloatRect& region, Fn fn) const {
+        ++m_stamp;
+        int x0 = std::max(cellOf(region.left), m_minX);
+        int y0 = std::max(cellOf(region.top), m_minY);
+        int x1 = std::min(cellOf(region.left + region.width), m_maxX);
+        int y1 = std::min(cellOf(region.top + region.height), m_maxY);
+        for (int cy = y0; cy <= y1; ++cy)
+            for (int cx = x0; cx <= x1; ++cx) {
+                auto it = m_cells.find(key(cx, cy));
+                if (it == m_cells.end())
+                    continue;
+                for (Proxy id : it->second) {
+                    const Entry& e = m_entries[id];
+                    if (e.stamp == m_stamp)
+                        continue;
+                    const_cast<Entry&>(e).stamp = m_stamp;
+                    if (overlaps(e.bounds, region))
+                        fn(e.object);
+                }
+            }
+    }
+
+    void query(const sf::FloatRect& region, std::vector<SpatialObject*>& out) const {
+        query(region, [&out](SpatialObject* o) { out.push_back(o); });
+    }
+
+    // Closest object by distance from p to its bounds, searching rings of
+    // cells outwards until no unvisited cell can hold anything closer.
+    SpatialObject* nearest(const sf::Vector2f& p,
+        float maxDistance = std::numeric_limits<float>::max()) const {
+        if (m_count == 0)
+            return nullptr;
+        ++m_stamp;
+        int pcx = cellOf(p.x);
+        int pcy = cellOf(p.y);
+        int maxRing = std::max(std::max(std::abs(pcx - m_minX), std::abs(pcx - m_maxX)),
+            std::max(std::abs(pcy - m_minY), std::abs(pcy - m_maxY)));
+
+        SpatialObject* best = nullptr;
+        float bestSq = maxDistance < std::sqrt(std::numeric_limits<float>::max())
+            ? maxDistance * maxDistance : std::numeric_limits<float>::max();
+
+        for (int r = 0; r <= maxRing; ++r) {
+            for (int cy = pcy - r; cy <= pcy + r; ++cy)
+                for (int cx = pcx - r; cx <= pcx + r; ++cx) {
+                    if (std::abs(cx - pcx) != r && std::abs(cy - pcy) != r)
+                        continue;
+                    auto it = m_cells.find(key(cx, cy));
+                    if (it == m_cells.end())
+                        continue;
+                    for (Proxy id : it->second) {
+                        const Entry& e = m_entries[id];
+                        if (e.stamp == m_stamp)
+                            continue;
+                        const_cast<Entry&>(e).stamp = m_stamp;
+                        float d = distanceSq(e.bounds, p);
+                        if (d <= bestSq) {
+                            bestSq = d;
+                            best = e.object;
+                        }
+                    }
+                }
+            // Cells in ring r+1 and beyond are at least r cells away.
+            float reach = r * m_cellSize;
+            if (reach * reach >= bestSq)
+                break;
+        }
+        return best;
+    }
+};
+
+// Drawable with world-space bounds that can be registered in a
+// SpatialGrid. Subclasses call refreshBounds() whenever their bounds
+// change. Copies start out unregistered.
+class SpatialObject : public virtual DrawableObject {
+    SpatialGrid* m_grid{ nullptr };
+    SpatialGrid::Proxy m_proxy{ -1 };
+public:
+    SpatialObject() = default;
+    SpatialObject(const SpatialObject&) : DrawableObject() {}
+    SpatialObject& operator=(const SpatialObject&) { return *this; }
+
+    virtual ~SpatialObject() { detach(); }
+
+    virtual sf::FloatRect bounds() const = 0;
+
+    void attach(SpatialGrid& grid) {
+        detach();
+        m_grid = &grid;
+        m_proxy = grid.insert(this, bounds());
+    }
+
+    void detach() {
+        if (!m_grid)
+            return;
+        m_grid->remove(m_proxy);
+        m_grid = nullptr;
+        m_proxy = -1;
+    }
+
+    SpatialGrid* grid() const { return m_grid; }
+    SpatialGrid::Proxy proxy() const { return m_proxy; }
+
+    void refreshBounds() {
+        if (m_grid)
+            m_grid->update(m_proxy, bounds());
+    }
+};
+
+// Shapes keep their rest-pose geometry and accumulate translate/rotate/
+// scale into one affine matrix, optionally below a parent shape. Each new
+// operation is applied after the ones before it, as the old in-place
+// versions were, and vertices are mapped through worldTransform() only
+// when they are drawn or queried.
+class ShapeObject : public virtual SpatialObject, public virtual TransformableObject {
+    sf::Transform m_transform;
+    const ShapeObject* m_parent{ nullptr };
+
+    void apply(const sf::Transform& t) {
+        m_transform = t * m_transform;
+        onTransformChanged();
+        refreshBounds();
+    }
+
+protected:
+    virtual void onTransformChanged() {}
+
+    // Rest-pose bounding box; bounds() maps it to world space.
+    virtual sf::FloatRect localBounds() const { return sf::FloatRect(); }
+
+public:
+    virtual ~ShapeObject() = default;
+
+    void translate(float dx, float dy) override {
+        if (dx == 0.f && dy == 0.f) return;
+        apply(sf::Transform().translate(dx, dy));
+    }
+
+    void rotate(float angleDeg) override {
+        if (std::fmod(angleDeg, 360.f) == 0.f) return;
+        apply(sf::Transform().rotate(angleDeg));
+    }
+
+    void scale(float sx, float sy) override {
+        if (sx == 1.f && sy == 1.f) return;
+        apply(sf::Transform().scale(sx, sy));
+    }
+
+    const sf::Transform& localTransform() const { return m_transform; }
+
+    void setLocalTransform(const sf::Transform& t) {
+        m_transform = t;
+        onTransformChanged();
+        refreshBounds();
+    }
+
+    void resetTransform() { setLocalTransform(sf::Transform::Identity); }
+
+    const ShapeObject* parent() const { return m_parent; }
+    // Children are not notified when a parent moves; call refreshBounds()
+    // on them if they are registered in a grid.
+    void setParent(const ShapeObject* parent) {
+        m_parent = parent;
+        onTransformChanged();
+        refreshBounds();
+    }
+
+    sf::Transform worldTransform() const {
+        if (!m_parent)
+            return m_transform;
+        return m_parent->worldTransform() * m_transform;
+    }
+
+    sf::Vector2f toWorld(const sf::Vector2f& p) const {
+        if (!m_parent)
+            return m_transform.transformPoint(p);
+        return worldTransform().transformPoint(p);
+    }
+
+    sf::FloatRect bounds() const override {
+        return worldTransform().transformRect(localBounds());
+    }
+};
+
+// Draw commands for one frame and one target. A command is a state
+// (layer, texture, primitive type, blend mode) plus a range of the
+// queue's vertices, which are already in world space. submit() sorts the
+// commands by a packed 64-bit key, merges every run of equal state into
+// one draw call and leaves the queue for clear(). Lower layers are drawn
+// first; within a layer commands are grouped by state and otherwise keep
+// recording order, as in SpriteBatch. Strips and fans are stored as lists
+// so any two commands with equal state can merge. A queue is not
+// thread-safe: workers record into queues of their own, which are then
+// append()ed in a fixed order.
+class RenderQueue {
+public:
+    // Key bits, high to low: layer 16, blend 4, texture 16, type 3 and
+    // recording sequence 25.
+    static constexpr unsigned SequenceBits = 25;
+    static constexpr std::size_t MaxCommands = std::size_t(1) << SequenceBits;
+    // Untextured points, lines and renderer pixels record here, over
+    // sprites on the default layer 0: texture id 0 sorts first within a
+    // layer, so on layer 0 they would end up under the sprites.
+    static constexpr int PrimitiveLayer = 1;
+
+private:
+    struct Command {
+        const sf::Texture* texture;
+        sf::BlendMode blend;
+        int layer;
+        sf::PrimitiveType type;
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+    // keyBegin/keyEnd span the batch's commands in m_keys. A batch whose
+    // commands were recorded back to back is drawn from m_vertices as is;
+    // the rest are gathered into m_merged.
+    struct Batch {
+        const sf::Texture* texture;
+        sf::BlendMode blend;
+        sf::PrimitiveType type;
+        std::size_t keyBegin;
+        std::size_t keyEnd;
+        std::size_t first;
+        std::size_t count;
+        bool gathered;
+    };
+
+    std::vector<Command> m_commands;
+    std::vector<sf::Vertex> m_vertices;
+    std::vector<std::uint64_t> m_keys;
+    std::vector<std::uint64_t> m_sortScratch;
+    std::vector<const sf::Texture*> m_textures;
+    std::vector<sf::BlendMode> m_blends;
+    std::vector<sf::Vertex> m_merged;
+    std::vector<Batch> m_batches;
+    std::size_t m_recorded{ 0 };
+
+    static bool sameState(const Command& c, int layer, const sf::Texture* texture,
+        sf::PrimitiveType type, const sf::BlendMode& blend) {
+        return c.layer == layer && c.texture == texture && c.type == type && c.blend == blend;
+    }
+
+    // Room for count vertices of a list type, extending the last command
+    // when its state matches; null once MaxCommands is reached.
+    sf::Vertex* reserve(std::size_t count, int layer, const sf::Texture* texture,
+        sf::PrimitiveType type, const sf::BlendMode& blend) {
+        std::size_t first = m_vertices.size();
+        if (!m_commands.empty() && sameState(m_commands.back(), layer, texture, type, blend))
+            m_commands.back().count += (std::uint32_t)count;
+        else if (m_commands.size() < MaxCommands)
+            m_commands.push_back({ texture, blend, layer, type, (std::uint32_t)first, (std::uint32_t)count });
+        else
+            return nullptr;
+        ++m_recorded;
+        m_vertices.resize(first + count);
+        return m_vertices.data() + first;
+    }
+
+    // Small dense IDs for the key; states past the field width share the
+    // last ID, which costs merging but not correctness.
+    std::uint64_t textureId(const sf::Texture* t) const {
+        std::size_t i = std::lower_bound(m_textures.begin(), m_textures.end(), t,
+            std::less<const sf::Texture*>()) - m_textures.begin();
+        return std::min<std::uint64_t>(i, 0xffff);
+    }
+
+    std::uint64_t blendId(const sf::BlendMode& b) const {
+        std::size_t i = std::find(m_blends.begin(), m_blends.end(), b) - m_blends.begin();
+        return std::min<std::uint64_t>(i, 0xf);
+    }
+
+    const Command& command(std::uint64_t key) const {
+        return m_commands[(std::size_t)(key & (MaxCommands - 1))];
+    }
+
+    std::uint64_t key(const Command& c, std::size_t sequence) const {
+        std::uint64_t layer = (std::uint64_t)(std::min(std::max(c.layer, -32768), 32767) + 32768);
+        return layer << 48 | blendId(c.blend) << 44 | textureId(c.texture) << 28 |
+            (std::uint64_t)c.type << SequenceBits | sequence;
+    }
+
+    // Keys are built in sequence order, so a stable LSD radix sort that
+    // skips the whole bytes below the state fields leaves them fully
+    // sorted. Bytes that are equal in every key, usually most of them, are
+    // skipped too.
+    void sortKeys() {
+        const std::size_t n = m_keys.size();
+        m_sortScratch.resize(n);
+        std::uint64_t* from = m_keys.data();
+        std::uint64_t* to = m_sortScratch.data();
+        for (unsigned shift = SequenceBits / 8 * 8; shift < 64; shift += 8) {
+            std::size_t offsets[256] = {};
+            for (std::size_t i = 0; i < n; ++i)
+                ++offsets[(from[i] >> shift) & 0xff];
+            if (offsets[(from[0] >> shift) & 0xff] == n)
+                continue;
+            std::size_t sum = 0;
+            for (std::size_t& o : offsets) {
+                std::size_t c = o;
+                o = sum;
+                sum += c;
+            }
+            for (std::size_t i = 0; i < n; ++i)
+                to[offsets[(from[i] >> shift) & 0xff]++] = from[i];
+            std::swap(from, to);
+        }
+        if (from != m_keys.data())
+            std::copy(from, from + n, m_keys.data());
+    }
+
+public:
+    void clear() {
+        m_commands.clear();
+        m_vertices.clear();
+        m_recorded = 0;
+    }
+
+    bool empty() const { return m_commands.empty(); }
+    // Commands as recorded, and as stored after merging neighbours.
+    std::size_t recordedCount() const { return m_recorded; }
+    std::size_t commandCount() const { return m_commands.size(); }
+    std::size_t vertexCount() const { return m_vertices.size(); }
+    // Draw calls of the last prepare() or submit().
+    std::size_t drawCalls() const { return m_batches.size(); }
+
+    bool add(const sf::Vertex* vertices, std::size_t count, sf::PrimitiveType type,
+        int layer = 0, const sf::Texture* texture = nullptr,
+        const sf::BlendMode& blend = sf::BlendAlpha) {
+        if (type == sf::LineStrip) {
+            if (count < 2)
+                return true;
+            sf::Vertex* out = reserve((count - 1) * 2, layer, texture, sf::Lines, blend);
+            if (!out)
+                return false;
+            for (std::size_t i = 0; i + 1 < count; ++i) {
+                *out++ = vertices[i];
+                *out++ = vertices[i + 1];
+            }
+            return true;
+        }
+        if (type == sf::TriangleStrip || type == sf::TriangleFan) {
+            if (count < 3)
+                return true;
+            sf::Vertex* out = reserve((count - 2) * 3, layer, texture, sf::Triangles, blend);
+            if (!out)
+                return false;
+            for (std::size_t i = 0; i + 2 < count; ++i) {
+                *out++ = vertices[type == sf::TriangleFan ? 0 : i];
+                *out++ = vertices[i + 1];
+                *out++ = vertices[i + 2];
+            }
+            return true;
+        }
+        if (count == 0)
+            return true;
+        sf::Vertex* out = reserve(count, layer, texture, type, blend);
+        if (!out)
+            return false;
+        std::copy(vertices, vertices + count, out);
+        return true;
+    }
+
+    bool add(const sf::VertexArray& vertices, int layer = 0,
+        const sf::Texture* texture = nullptr, const sf::BlendMode& blend = sf::BlendAlpha) {
+        if (vertices.getVertexCount() == 0)
+            return true;
+        return add(&vertices[0], vertices.getVertexCount(), vertices.getPrimitiveType(),
+            layer, texture, blend);
+    }
+
+    // Textured quad, same arguments as SpriteBatch::add.
+    bool add(const sf::Texture* texture, const sf::IntRect& r,
+        const sf::Transform& t, sf::Color c, int layer = 0) {
+        sf::Vertex* out = reserve(6, layer, texture, sf::Triangles, sf::BlendAlpha);
+        if (!out)
+            return false;
+        float w = (float)std::abs(r.width);
+        float h = (float)std::abs(r.height);
+        float left = (float)r.left;
+        float right = left + (float)r.width;
+        float top = (float)r.top;
+        float bottom = top + (float)r.height;
+        sf::Vertex q0(t.transformPoint(0.f, 0.f), c, sf::Vector2f(left, top));
+        sf::Vertex q2(t.transformPoint(w, h), c, sf::Vector2f(right, bottom));
+        out[0] = q0;
+        out[1] = sf::Vertex(t.transformPoint(w, 0.f), c, sf::Vector2f(right, top));
+        out[2] = q2;
+        out[3] = q0;
+        out[4] = q2;
+        out[5] = sf::Vertex(t.transformPoint(0.f, h), c, sf::Vector2f(left, bottom));
+        return true;
+    }
+
+    bool add(const sf::Sprite& sprite, int layer = 0) {
+        return add(sprite.getTexture(), sprite.getTextureRect(),
+            sprite.getTransform(), sprite.getColor(), layer);
+    }
+
+    // other's commands follow this queue's, in their order.
+    bool append(const RenderQueue& other) {
+        for (const Command& c : other.m_commands) {
+            sf::Vertex* out = reserve(c.count, c.layer, c.texture, c.type, c.blend);
+            if (!out)
+                return false;
+            const sf::Vertex* from = other.m_vertices.data() + c.first;
+            std::copy(from, from + c.count, out);
+        }
+        m_recorded += other.m_recorded - other.m_commands.size();
+        return true;
+    }
+
+    // Sorts and merges without drawing; submit() calls it.
+    std::size_t prepare() {
+        m_batches.clear();
+        if (m_commands.empty())
+            return 0;
+
+        // A small direct-mapped filter keeps repeated textures out of the
+        // list before it is sorted and deduplicated.
+        const sf::Texture* seen[64] = {};
+        m_textures.assign(1, nullptr);
+        m_blends.clear();
+        for (const Command& c : m_commands) {
+            std::uintptr_t p = (std::uintptr_t)c.texture;
+            const sf::Texture*& slot = seen[((p >> 4) ^ (p >> 10)) & 63];
+            if (slot != c.texture) {
+                slot = c.texture;
+                m_textures.push_back(c.texture);
+            }
+            if (std::find(m_blends.begin(), m_blends.end(), c.blend) == m_blends.end())
+                m_blends.push_back(c.blend);
+        }
+        std::sort(m_textures.begin(), m_textures.end(), std::less<const sf::Texture*>());
+        m_textures.erase(std::unique(m_textures.begin(), m_textures.end()), m_textures.end());
+
+        m_keys.resize(m_commands.size());
+        for (std::size_t i = 0; i < m_commands.size(); ++i)
+            m_keys[i] = key(m_commands[i], i);
+        sortKeys();
+
+        const Command* last = nullptr;
+        for (std::size_t i = 0; i < m_keys.size(); ++i) {
+            const Command& c = command(m_keys[i]);
+            if (last && sameState(c, last->layer, last->texture, last->type, last->blend)) {
+                Batch& b = m_batches.back();
+                b.gathered = b.gathered || c.first != last->first + last->count;
+                b.keyEnd = i + 1;
+                b.count += c.count;
+            }
+            else
+                m_batches.push_back({ c.texture, c.blend, c.type, i, i + 1, c.first, c.count, false });
+            last = &c;
+        }
+
+        m_merged.resize(m_vertices.size());
+        std::size_t out = 0;
+        for (Batch& b : m_batches) {
+            if (!b.gathered)
+                continue;
+            b.first = out;
+            for (std::size_t i = b.keyBegin; i < b.keyEnd; ++i) {
+                const Command& c = command(m_keys[i]);
+                std::copy(m_vertices.begin() + c.first, m_vertices.begin() + c.first + c.count,
+                    m_merged.begin() + out);
+                out += c.count;
+            }
+        }
+        return m_batches.size();
+    }
+
+    void submit(sf::RenderTarget& target) {
+        prepare();
+        for (const Batch& b : m_batches) {
+            sf::RenderStates states(b.blend);
+            states.texture = b.texture;
+            const sf::Vertex* vertices = b.gathered ? m_merged.data() : m_vertices.data();
+            target.draw(vertices + b.first, b.count, b.type, states);
+        }
+    }
+};
+
+class PrimitiveRenderer;
+
+// Struct-of-arrays point storage for bulk transforms: one trig pair per
+// call and straight loops over contiguous x[]/y[] arrays. Segments are
+// index pairs into the same point arrays.
+class GeometryBuffer {
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<sf::Color> m_color;
+    std::vector<std::uint32_t> m_segA;
+    std::vector<std::uint32_t> m_segB;
+    sf::VertexArray m_vertices;
+
+    void clampRange(std::size_t& first, std::size_t& count) const {
+        first = std::min(first, m_x.size());
+        count = std::min(count, m_x.size() - first);
+    }
+
+public:
+    GeometryBuffer() = default;
+
+    void reserve(std::size_t points) {
+        m_x.reserve(points);
+        m_y.reserve(points);
+        m_color.reserve(points);
+    }
+
+    void clear() {
+        m_x.clear();
+        m_y.clear();
+        m_color.clear();
+        m_segA.clear();
+        m_segB.clear();
+    }
+
+    std::size_t addPoint(float x, float y, sf::Color color = sf::Color::White) {
+        m_x.push_back(x);
+        m_y.push_back(y);
+        m_color.push_back(color);
+        return m_x.size() - 1;
+    }
+
+    std::size_t addSegment(const sf::Vector2f& a, const sf::Vector2f& b,
+        sf::Color color = sf::Color::White) {
+        m_segA.push_back((std::uint32_t)addPoint(a.x, a.y, color));
+        m_segB.push_back((std::uint32_t)addPoint(b.x, b.y, color));
+        return m_segA.size() - 1;
+    }
+
+    std::size_t pointCount() const { return m_x.size(); }
+    std::size_t segmentCount() const { return m_segA.size(); }
+    std::size_t segmentA(std::size_t s) const { return m_segA[s]; }
+    std::size_t segmentB(std::size_t s) const { return m_segB[s]; }
+
+    float x(std::size_t i) const { return m_x[i]; }
+    float y(std::size_t i) const { return m_y[i]; }
+    void set(std::size_t i, float x, float y) {
+        m_x[i] = x;
+        m_y[i] = y;
+    }
+
+    sf::Color color(std::size_t i) const { return m_color[i]; }
+    void setColor(std::size_t i, sf::Color c) { m_color[i] = c; }
+
+    float* xData() { return m_x.data(); }
+    float* yData() { return m_y.data(); }
+
+    void translate(std::size_t first, std::size_t count, float dx, float dy) {
+        clampRange(first, count);
+        float* xs = m_x.data() + first;
+        float* ys = m_y.data() + first;
+        for (std::size_t i = 0; i < count; ++i) {
+            xs[i] += dx;
+            ys[i] += dy;
+        }
+    }
+
+    void rotate(std::size_t first, std::size_t count, float angleDeg) {
+        clampRange(first, count);
+        float rad = angleDeg * 3.14159265359f / 180.f;
+        float cs = std::cos(rad);
+        float sn = std::sin(rad);
+        float* xs = m_x.data() + first;
+        float* ys = m_y.data() + first;
+        for (std::size_t i = 0; i < count; ++i) {
+            float px = xs[i];
+            float py = ys[i];
+            xs[i] = px * cs - py * sn;
+            ys[i] = px * sn + py * cs;
+        }
+    }
+
+    void scale(std::size_t first, std::size_t count, float sx, float sy) {
+        clampRange(first, count);
+        float* xs = m_x.data() + first;
+        float* ys = m_y.data() + first;
+        for (std::size_t i = 0; i < count; ++i) {
+            xs[i] *= sx;
+            ys[i] *= sy;
+        }
+    }
+
+    void translate(float dx, float dy) { translate(0, m_x.size(), dx, dy); }
+    void rotate(float angleDeg) { rotate(0, m_x.size(), angleDeg); }
+    void scale(float sx, float sy) { scale(0, m_x.size(), sx, sy); }
+
+    void drawPoints(sf::RenderTarget& target) {
+        m_vertices.setPrimitiveType(sf::Points);
+        m_vertices.resize(m_x.size());
+        for (std::size_t i = 0; i < m_x.size(); ++i)
+            m_vertices[i] = sf::Vertex(sf::Vector2f(m_x[i], m_y[i]), m_color[i]);
+        target.draw(m_vertices);
+    }
+
+    void drawSegments(sf::RenderTarget& target) {
+        m_vertices.setPrimitiveType(sf::Lines);
+        m_vertices.resize(m_segA.size() * 2);
+        for (std::size_t s = 0; s < m_segA.size(); ++s) {
+            std::uint32_t a = m_segA[s];
+            std::uint32_t b = m_segB[s];
+            m_vertices[2 * s] = sf::Vertex(sf::Vector2f(m_x[a], m_y[a]), m_color[a]);
+            m_vertices[2 * s + 1] = sf::Vertex(sf::Vector2f(m_x[b], m_y[b]), m_color[b]);
+        }
+        target.draw(m_vertices);
+    }
+};
+
+// Either owns its rest coordinates or, when constructed from a
+// GeometryBuffer, acts as a handle to one of its points. x()/y() and
+// position() include the shape transform; rest*() do not.
+class Point2D : public ShapeObject {
+    sf::Vector2f m_pos;
+    sf::Color    m_color;
+    GeometryBuffer* m_buffer{ nullptr };
+    std::size_t m_index{ 0 };
+
+protected:
+    sf::FloatRect localBounds() const override {
+        return sf::FloatRect(restX(), restY(), 0.f, 0.f);
+    }
+
+public:
+    Point2D() : m_pos(0.f, 0.f), m_color(sf::Color::White) {}
+    Point2D(float x, float y, sf::Color color = sf::Color::White)
+        : m_pos(x, y), m_color(color) {
+    }
+    Point2D(GeometryBuffer& buffer, std::size_t index)
+        : m_pos(0.f, 0.f), m_color(sf::Color::White),
+        m_buffer(&buffer), m_index(index) {
+    }
+
+    bool isHandle() const { return m_buffer != nullptr; }
+
+    float restX() const { return m_buffer ? m_buffer->x(m_index) : m_pos.x; }
+    float restY() const { return m_buffer ? m_buffer->y(m_index) : m_pos.y; }
+    sf::Vector2f restPosition() const { return { restX(), restY() }; }
+
+    sf::Vector2f position() const { return toWorld(restPosition()); }
+    float x() const { return position().x; }
+    float y() const { return position().y; }
+
+    void set(float x, float y) {
+        if (m_buffer)
+            m_buffer->set(m_index, x, y);
+        else
+            m_pos = { x, y };
+        refreshBounds();
+    }
+
+    void setColor(const sf::Color& c) {
+        if (m_buffer)
+            m_buffer->setColor(m_index, c);
+        else
+            m_color = c;
+    }
+    sf::Color color() const { return m_buffer ? m_buffer->color(m_index) : m_color; }
+
+    void draw(sf::RenderTarget& target) override {
+        sf::Vertex v(position(), color());
+        target.draw(&v, 1, sf::Points);
+    }
+
+    bool record(RenderQueue& queue) override {
+        sf::Vertex v(position(), color());
+        return queue.add(&v, 1, sf::Points, RenderQueue::PrimitiveLayer);
+    }
+};
+
+class LineSegment : public ShapeObject {
+    Point2D m_a;
+    Point2D m_b;
+    sf::Color m_color;
+    PrimitiveRenderer* m_renderer;
+
+protected:
+    sf::FloatRect localBounds() const override {
+        sf::Vector2f a = m_a.position();
+        sf::Vector2f b = m_b.position();
+        return sf::FloatRect(std::min(a.x, b.x), std::min(a.y, b.y),
+            std::abs(b.x - a.x), std::abs(b.y - a.y));
+    }
+
+public:
+    LineSegment()
+        : m_a(), m_b(), m_color(sf::Color::White), m_renderer(nullptr) {
+    }
+
+    LineSegment(PrimitiveRenderer& renderer,
+        const Point2D& a, const Point2D& b,
+        sf::Color color = sf::Color::White)
+        : m_a(a), m_b(b), m_color(color), m_renderer(&renderer) {
+    }
+
+    LineSegment(PrimitiveRenderer& renderer,
+        GeometryBuffer& buffer, std::size_t segment,
+        sf::Color color = sf::Color::White)
+        : m_a(buffer, buffer.segmentA(segment)),
+        m_b(buffer, buffer.segmentB(segment)),
+        m_color(color), m_renderer(&renderer) {
+    }
+
+    const Point2D& a() const { return m_a; }
+    const Point2D& b() const { return m_b; }
+
+    sf::Vector2f worldA() const { return toWorld(m_a.position()); }
+    sf::Vector2f worldB() const { return toWorld(m_b.position()); }
+
+    void setRenderer(PrimitiveRenderer& r) { m_renderer = &r; }
+
+    void setColor(const sf::Color& c) { m_color = c; }
+
+    void draw(sf::RenderTarget& target) override;
+    bool record(RenderQueue& queue) override;
+};
+
+// Row kernels for RGBA8 pixels. SSE2/AVX2 or NEON versions are picked once
+// from the CPU, with a scalar fallback; every version produces the same
+// bytes. The blend divides exactly, as sf::Image::copy does, so it can
+// replace that copy pixel for pixel.
+class PixelKernels {
+public:
+    enum class Isa { Scalar, SSE2, AVX2, NEON };
+
+    typedef void (*BlendFn)(const sf::Uint32* src, sf::Uint32* dst, std::size_t n);
+    typedef void (*FillFn)(sf::Uint32* dst, std::size_t n, sf::Uint32 color);
+    typedef void (*KeyFn)(sf::Uint32* px, std::size_t n, sf::Uint32 key, sf::Uint8 alpha);
+    typedef void (*PremultiplyFn)(sf::Uint32* px, std::size_t n);
+
+    struct Table {
+        Isa isa;
+        BlendFn blend;
+        FillFn fill;
+        KeyFn key;
+        PremultiplyFn premultiply;
+    };
+
+private:
+    // Mask of the alpha byte in a packed pixel, whatever the endianness.
+    static sf::Uint32 alphaMask() {
+        const sf::Uint8 bytes[4] = { 0, 0, 0, 255 };
+        sf::Uint32 v;
+        std::memcpy(&v, bytes, sizeof(v));
+        return v;
+    }
+
+    static sf::Uint32 alphaBits(sf::Uint8 alpha) {
+        const sf::Uint8 bytes[4] = { 0, 0, 0, alpha };
+        sf::Uint32 v;
+        std::memcpy(&v, bytes, sizeof(v));
+        return v;
+    }
+
+    // floor(x / 255) and round(x / 255), exact for x <= 255 * 255.
+    static unsigned div255(unsigned x) { return (x + 1 + (x >> 8)) >> 8; }
+    static unsigned div255Round(unsigned x) {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    // rgb = src * a + dst * (255 - a), alpha = a + dst.a * (255 - a), / 255.
+    static void blendScalar(const sf::Uint32* src, sf::Uint32* dst, std::size_t n) {
+        const sf::Uint8* s = reinterpret_cast<const sf::Uint8*>(src);
+        sf::Uint8* d = reinterpret_cast<sf::Uint8*>(dst);
+        for (std::size_t i = 0; i < n; ++i, s += 4, d += 4) {
+            unsigned a = s[3];
+            unsigned inv = 255 - a;
+            d[0] = (sf::Uint8)div255(s[0] * a + d[0] * inv);
+            d[1] = (sf::Uint8)div255(s[1] * a + d[1] * inv);
+            d[2] = (sf::Uint8)div255(s[2] * a + d[2] * inv);
+            d[3] = (sf::Uint8)(a + div255(d[3] * inv));
+        }
+    }
+
+    static void fillScalar(sf::Uint32* dst, std::size_t n, sf::Uint32 color) {
+        std::fill(dst, dst + n, color);
+    }
+
+    static void keyScalar(sf::Uint32* px, std::size_t n, sf::Uint32 key, sf::Uint8 alpha) {
+        const sf::Uint32 mask = alphaMask();
+        const sf::Uint32 bits = alphaBits(alpha);
+        for (std::size_t i = 0; i < n; ++i)
+            if (px[i] == key)
+                px[i] = (px[i] & ~mask) | bits;
+    }
+
+    static void premultiplyScalar(sf::Uint32* px, std::size_t n) {
+        sf::Uint8* p = reinterpret_cast<sf::Uint8*>(px);
+        for (std::size_t i = 0; i < n; ++i, p += 4) {
+            unsigned a = p[3];
+            p[0] = (sf::Uint8)div255Round(p[0] * a);
+            p[1] = (sf::Uint8)div255Round(p[1] * a);
+            p[2] = (sf::Uint8)div255Round(p[2] * a);
+        }
+    }
+
+#if defined(SILNIK2D_X86)
+    // The 128-bit kernels work on two pixels widened to 16-bit lanes
+    // (r g b a r g b a). The alpha lane is multiplied by 255 instead of
+    // alpha, which turns the colour formula into the alpha one.
+    SILNIK2D_TARGET("sse2")
+    static __m128i div255SSE2(__m128i t) {
+        return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, _mm_set1_epi16(1)),
+            _mm_srli_epi16(t, 8)), 8);
+    }
+
+    SILNIK2D_TARGET("sse2")
+    static __m128i alphaFactorsSSE2(__m128i s, __m128i* inv) {
+        const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+        const __m128i c255 = _mm_set1_epi16(255);
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)),
+            _MM_SHUFFLE(3, 3, 3, 3));
+        if (inv)
+            *inv = _mm_sub_epi16(c255, a);
+        return _mm_or_si128(_mm_andnot_si128(alphaLanes, a), _mm_and_si128(alphaLanes, c255));
+    }
+
+    SILNIK2D_TARGET("sse2")
+    static __m128i blendHalfSSE2(__m128i s, __m128i d) {
+        __m128i inv;
+        __m128i m = alphaFactorsSSE2(s, &inv);
+        return div255SSE2(_mm_add_epi16(_mm_mullo_epi16(s, m), _mm_mullo_epi16(d, inv)));
+    }
+
+    SILNIK2D_TARGET("sse2")
+    static void blendSSE2(const sf::Uint32* src, sf::Uint32* dst, std::size_t n) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i amask = _mm_set1_epi32((int)alphaMask());
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i a = _mm_and_si128(s, amask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, amask)) == 0xFFFF) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), s);
+                continue;
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xFFFF)
+                continue;
+
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            __m128i lo = blendHalfSSE2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+            __m128i hi = blendHalfSSE2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+        }
+        blendScalar(src + i, dst + i, n - i);
+    }
+
+    SILNIK2D_TARGET("sse2")
+    static void fillSSE2(sf::Uint32* dst, std::size_t n, sf::Uint32 color) {
+        const __m128i c = _mm_set1_epi32((int)color);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), c);
+        fillScalar(dst + i, n - i, color);
+    }
+
+    SILNIK2D_TARGET("sse2")
+    static void keySSE2(sf::Uint32* px, std::size_t n, sf::Uint32 key, sf::Uint8 alpha) {
+        const __m128i k = _mm_set1_epi32((int)key);
+        const __m128i mask = _mm_set1_epi32((int)alphaMask());
+        const __m128i bits = _mm_set1_epi32((int)alphaBits(alpha));
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px + i));
+            __m128i eq = _mm_cmpeq_epi32(p, k);
+            __m128i m = _mm_and_si128(eq, mask);
+            p = _mm_or_si128(_mm_andnot_si128(m, p), _mm_and_si128(eq, bits));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(px + i), p);
+        }
+        keyScalar(px + i, n - i, key, alpha);
+    }
+
+    SILNIK2D_TARGET("sse2")
+    static __m128i premultiplyHalfSSE2(__m128i p) {
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(p, alphaFactorsSSE2(p, nullptr)),
+            _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    SILNIK2D_TARGET("sse2")
+    static void premultiplySSE2(sf::Uint32* px, std::size_t n) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i amask = _mm_set1_epi32((int)alphaMask());
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(p, amask), amask)) == 0xFFFF)
+                continue;
+            __m128i lo = premultiplyHalfSSE2(_mm_unpacklo_epi8(p, zero));
+            __m128i hi = premultiplyHalfSSE2(_mm_unpackhi_epi8(p, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(px + i), _mm_packus_epi16(lo, hi));
+        }
+        premultiplyScalar(px + i, n - i);
+    }
+
+    // Same lane layout as SSE2, eight pixels per iteration. Unpack and
+    // pack both work within 128-bit halves, so pixel order is kept.
+    SILNIK2D_TARGET("avx2")
+    static __m256i div255AVX2(__m256i t) {
+        return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(t, _mm256_set1_epi16(1)),
+            _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    SILNIK2D_TARGET("avx2")
+    static __m256i alphaFactorsAVX2(__m256i s, __m256i* inv) {
+        const __m256i alphaLanes = _mm256_set1_epi64x((long long)0xFFFF000000000000ull);
+        const __m256i c255 = _mm256_set1_epi16(255);
+        __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)),
+            _MM_SHUFFLE(3, 3, 3, 3));
+        if (inv)
+            *inv = _mm256_sub_epi16(c255, a);
+        return _mm256_blendv_epi8(a, c255, alphaLanes);
+    }
+
+    SILNIK2D_TARGET("avx2")
+    static __m256i blendHalfAVX2(__m256i s, __m256i d) {
+        __m256i inv;
+        __m256i m = alphaFactorsAVX2(s, &inv);
+        return div255AVX2(_mm256_add_epi16(_mm256_mullo_epi16(s, m), _mm256_mullo_epi16(d, inv)));
+    }
+
+    SILNIK2D_TARGET("avx2")
+    static void blendAVX2(const sf::Uint32* src, sf::Uint32* dst, std::size_t n) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i amask = _mm256_set1_epi32((int)alphaMask());
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i a = _mm256_and_si256(s, amask);
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, amask)) == -1) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), s);
+                continue;
+            }
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, zero)) == -1)
+                continue;
+
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            __m256i lo = blendHalfAVX2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+            __m256i hi = blendHalfAVX2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(lo, hi));
+        }
+        blendSSE2(src + i, dst + i, n - i);
+    }
+
+    SILNIK2D_TARGET("avx2")
+    static void fillAVX2(sf::Uint32* dst, std::size_t n, sf::Uint32 color) {
+        const __m256i c = _mm256_set1_epi32((int)color);
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), c);
+        fillSSE2(dst + i, n - i, color);
+    }
+
+    SILNIK2D_TARGET("avx2")
+    static void keyAVX2(sf::Uint32* px, std::size_t n, sf::Uint32 key, sf::Uint8 alpha) {
+        const __m256i k = _mm256_set1_epi32((int)key);
+        const __m256i mask = _mm256_set1_epi32((int)alphaMask());
+        const __m256i bits = _mm256_set1_epi32((int)alphaBits(alpha));
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(px + i));
+            __m256i eq = _mm256_cmpeq_epi32(p, k);
+            __m256i m = _mm256_and_si256(eq, mask);
+            p = _mm256_or_si256(_mm256_andnot_si256(m, p), _mm256_and_si256(eq, bits));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(px + i), p);
+        }
+        keySSE2(px + i, n - i, key, alpha);
+    }
+
+    SILNIK2D_TARGET("avx2")
+    static __m256i premultiplyHalfAVX2(__m256i p) {
+        __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(p, alphaFactorsAVX2(p, nullptr)),
+            _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    SILNIK2D_TARGET("avx2")
+    static void premultiplyAVX2(sf::Uint32* px, std::size_t n) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i amask = _mm256_set1_epi32((int)alphaMask());
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(px + i));
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(p, amask), amask)) == -1)
+                continue;
+            __m256i lo = premultiplyHalfAVX2(_mm256_unpacklo_epi8(p, zero));
+            __m256i hi = premultiplyHalfAVX2(_mm256_unpackhi_epi8(p, zero));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(px + i), _mm256_packus_epi16(lo, hi));
+        }
+        premultiplySSE2(px + i, n - i);
+    }
+#endif
+
+#if defined(SILNIK2D_NEON)
+    // vld4 splits eight pixels into r, g, b, a planes, so each channel is
+    // one widening multiply-accumulate.
+    static uint8x8_t div255NEON(uint16x8_t t) {
+        return vshrn_n_u16(vaddq_u16(vaddq_u16(t, vdupq_n_u16(1)), vshrq_n_u16(t, 8)), 8);
+    }
+
+    static uint8x8_t div255RoundNEON(uint16x8_t t) {
+        t = vaddq_u16(t, vdupq_n_u16(128));
+        return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+    }
+
+    static void blendNEON(const sf::Uint32* src, sf::Uint32* dst, std::size_t n) {
+        const uint8x8_t c255 = vdup_n_u8(255);
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+            uint8x8x4_t d = vld4_u8(reinterpret_cast<const uint8_t*>(dst + i));
+            uint8x8_t a = s.val[3];
+            uint8x8_t inv = vsub_u8(c255, a);
+            for (int c = 0; c < 3; ++c)
+                d.val[c] = div255NEON(vmlal_u8(vmull_u8(s.val[c], a), d.val[c], inv));
+            d.val[3] = div255NEON(vmlal_u8(vmull_u8(a, c255), d.val[3], inv));
+            vst4_u8(reinterpret_cast<uint8_t*>(dst + i), d);
+        }
+        blendScalar(src + i, dst + i, n - i);
+    }
+
+    static void fillNEON(sf::Uint32* dst, std::size_t n, sf::Uint32 color) {
+        const uint32x4_t c = vdupq_n_u32(color);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            vst1q_u32(dst + i, c);
+        fillScalar(dst + i, n - i, color);
+    }
+
+    static void keyNEON(sf::Uint32* px, std::size_t n, sf::Uint32 key, sf::Uint8 alpha) {
+        const uint32x4_t k = vdupq_n_u32(key);
+        const uint32x4_t mask = vdupq_n_u32(alphaMask());
+        const uint32x4_t bits = vdupq_n_u32(alphaBits(alpha));
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            uint32x4_t p = vld1q_u32(px + i);
+            uint32x4_t m = vandq_u32(vceqq_u32(p, k), mask);
+            vst1q_u32(px + i, vbslq_u32(m, bits, p));
+        }
+        keyScalar(px + i, n - i, key, alpha);
+    }
+
+    static void premultiplyNEON(sf::Uint32* px, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint8x8x4_t p = vld4_u8(reinterpret_cast<const uint8_t*>(px + i));
+            for (int c = 0; c < 3; ++c)
+                p.val[c] = div255RoundNEON(vmull_u8(p.val[c], p.val[3]));
+            vst4_u8(reinterpret_cast<uint8_t*>(px + i), p);
+        }
+        premultiplyScalar(px + i, n - i);
+    }
+#endif
+
+    static Table tableFor(Isa isa) {
+        switch (isa) {
+#if defined(SILNIK2D_X86)
+        case Isa::SSE2:
+            return Table{ isa, &blendSSE2, &fillSSE2, &keySSE2, &premultiplySSE2 };
+        case Isa::AVX2:
+            return Table{ isa, &blendAVX2, &fillAVX2, &keyAVX2, &premultiplyAVX2 };
+#endif
+#if defined(SILNIK2D_NEON)
+        case Isa::NEON:
+            return Table{ isa, &blendNEON, &fillNEON, &keyNEON, &premultiplyNEON };
+#endif
+        default:
+            return Table{ Isa::Scalar, &blendScalar, &fillScalar, &keyScalar, &premultiplyScalar };
+        }
+    }
+
+    static Table& active() {
+        static Table table = tableFor(best());
+        return table;
+    }
+
+public:
+    static bool supported(Isa isa) {
+        switch (isa) {
+        case Isa::Scalar:
+            return true;
+#if defined(SILNIK2D_X86) && defined(_MSC_VER)
+        case Isa::SSE2: {
+            int r[4];
+            __cpuid(r, 1);
+            return (r[3] & (1 << 26)) != 0;
+        }
+        case Isa::AVX2: {
+            int r[4];
+            __cpuid(r, 0);
+            if (r[0] < 7)
+                return false;
+            __cpuid(r, 1);
+            // The OS must save the YMM registers (OSXSAVE, then XCR0).
+            if ((r[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+                return false;
+            __cpuidex(r, 7, 0);
+            return (r[1] & (1 << 5)) != 0;
+        }
+#elif defined(SILNIK2D_X86)
+        case Isa::SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case Isa::AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+#if defined(SILNIK2D_NEON)
+        case Isa::NEON:
+            return true;
+#endif
+        default:
+            return false;
+        }
+    }
+
+    static Isa best() {
+        if (supported(Isa::AVX2))
+            return Isa::AVX2;
+        if (supported(Isa::SSE2))
+            return Isa::SSE2;
+        if (supported(Isa::NEON))
+            return Isa::NEON;
+        return Isa::Scalar;
+    }
+
+    static Isa isa() { return active().isa; }
+
+    // For tests and benchmarks; not safe while other threads use the kernels.
+    static bool setIsa(Isa isa) {
+        if (!supported(isa))
+            return false;
+        active() = tableFor(isa);
+        return true;
+    }
+
+    static const char* name(Isa isa) {
+        switch (isa) {
+        case Isa::SSE2: return "sse2";
+        case Isa::AVX2: return "avx2";
+        case Isa::NEON: return "neon";
+        default: return "scalar";
+        }
+    }
+
+    static void blend(const sf::Uint32* src, sf::Uint32* dst, std::size_t n) {
+        active().blend(src, dst, n);
+    }
+
+    static void fill(sf::Uint32* dst, std::size_t n, sf::Uint32 color) {
+        active().fill(dst, n, color);
+    }
+
+    // Pixels equal to key get the given alpha, like sf::Image::createMaskFromColor.
+    static void colorKey(sf::Uint32* px, std::size_t n, sf::Uint32 key, sf::Uint8 alpha) {
+        active().key(px, n, key, alpha);
+    }
+
+    static void premultiply(sf::Uint32* px, std::size_t n) {
+        active().premultiply(px, n);
+    }
+};
+
+// Non-owning view of an RGBA8 pixel buffer addressed as packed 32-bit
+// values. sf::Image only exposes a const pointer, but its storage is a
+// plain contiguous array, so writing through it is safe as long as the
+// image is not resized while the view exists.
+class PixelView {
+    sf::Uint32* m_pixels{ nullptr };
+    unsigned m_width{ 0 };
+    unsigned m_height{ 0 };
+public:
+    PixelView() = default;
+    PixelView(sf::Uint32* pixels, unsigned width, unsigned height)
+        : m_pixels(pixels), m_width(width), m_height(height) {
+    }
+
+    explicit PixelView(sf::Image& img)
+        : m_pixels(reinterpret_cast<sf::Uint32*>(
+            const_cast<sf::Uint8*>(img.getPixelsPtr()))),
+        m_width(img.getSize().x), m_height(img.getSize().y) {
+    }
+
+    static sf::Uint32 pack(const sf::Color& c) {
+        const sf::Uint8 bytes[4] = { c.r, c.g, c.b, c.a };
+        sf::Uint32 v;
+        std::memcpy(&v, bytes, sizeof(v));
+        return v;
+    }
+
+    static sf::Color unpack(sf::Uint32 v) {
+        sf::Uint8 bytes[4];
+        std::memcpy(bytes, &v, sizeof(v));
+        return sf::Color(bytes[0], bytes[1], bytes[2], bytes[3]);
+    }
+
+    unsigned width() const { return m_width; }
+    unsigned height() const { return m_height; }
+    bool empty() const { return m_pixels == nullptr; }
+
+    bool contains(int x, int y) const {
+        return x >= 0 && y >= 0 &&
+            (unsigned)x < m_width && (unsigned)y < m_height;
+    }
+
+    sf::Uint32* data() { return m_pixels; }
+    const sf::Uint32* data() const { return m_pixels; }
+
+    sf::Uint32* row(unsigned y) { return m_pixels + (std::size_t)y * m_width; }
+    const sf::Uint32* row(unsigned y) const { return m_pixels + (std::size_t)y * m_width; }
+
+    sf::Uint32& at(unsigned x, unsigned y) { return row(y)[x]; }
+    sf::Uint32 at(unsigned x, unsigned y) const { return row(y)[x]; }
+
+    void fill(sf::Uint32 color) {
+        PixelKernels::fill(m_pixels, (std::size_t)m_width * m_height, color);
+    }
+
+    void fillRect(const sf::IntRect& rect, sf::Uint32 color) {
+        int x0 = std::max(rect.left, 0);
+        int y0 = std::max(rect.top, 0);
+        int x1 = std::min(rect.left + rect.width, (int)m_width);
+        int y1 = std::min(rect.top + rect.height, (int)m_height);
+        if (x0 >= x1 || y0 >= y1)
+            return;
+
+        for (int y = y0; y < y1; ++y)
+            PixelKernels::fill(row(y) + x0, (std::size_t)(x1 - x0), color);
+    }
+};
+
+// Persistent GPU copy of a CPU pixel buffer. Changed rectangles are
+// queued with markDirty() and sent with sf::Texture::update on upload();
+// after create() nothing is reallocated. Two textures alternate so an
+// upload never writes the texture the last frame is still drawing from.
+// Each keeps its own pending rectangles, so a change is sent to both, one
+// frame apart.
+class StreamingTexture : public DrawableObject {
+public:
+    static constexpr unsigned MaxBuffers = 2;
+    // Past this many pending rectangles they collapse into their bounds.
+    static constexpr std::size_t MaxRects = 64;
+
+private:
+    sf::Texture m_textures[MaxBuffers];
+    std::vector<sf::IntRect> m_pending[MaxBuffers];
+    unsigned m_buffers{ 0 };
+    unsigned m_front{ 0 };
+    unsigned m_width{ 0 };
+    unsigned m_height{ 0 };
+    sf::Sprite m_sprite;
+    PixelView m_source;
+    std::vector<sf::Uint8> m_staging;
+    std::size_t m_uploadedPixels{ 0 };
+
+    static long long area(const sf::IntRect& r) {
+        return (long long)r.width * r.height;
+    }
+
+    static sf::IntRect unite(const sf::IntRect& a, const sf::IntRect& b) {
+        int l = std::min(a.left, b.left);
+        int t = std::min(a.top, b.top);
+        int r = std::max(a.left + a.width, b.left + b.width);
+        int bt = std::max(a.top + a.height, b.top + b.height);
+        return sf::IntRect(l, t, r - l, bt - t);
+    }
+
+    // Rectangles merge only when their bounds cost no more than sending
+    // them apart: overlaps, and neighbours sharing a full edge.
+    static void queue(std::vector<sf::IntRect>& list, sf::IntRect r) {
+        for (std::size_t i = 0; i < list.size();) {
+            sf::IntRect u = unite(list[i], r);
+            if (area(u) <= area(list[i]) + area(r)) {
+                r = u;
+                list[i] = list.back();
+                list.pop_back();
+                i = 0;
+            }
+            else {
+                ++i;
+            }
+        }
+        list.push_back(r);
+
+        if (list.size() > MaxRects) {
+            sf::IntRect bounds = list[0];
+            for (const sf::IntRect& q : list)
+                bounds = unite(bounds, q);
+            list.assign(1, bounds);
+        }
+    }
+
+    void uploadRect(sf::Texture& texture, const sf::IntRect& r) {
+        const unsigned x = (unsigned)r.left;
+        const unsigned y = (unsigned)r.top;
+        const unsigned w = (unsigned)r.width;
+        const unsigned h = (unsigned)r.height;
+        const sf::Uint8* src = reinterpret_cast<const sf::Uint8*>(m_source.row(y) + x);
+        if (w == m_width) {
+            texture.update(src, w, h, 0, y);
+        }
+        else {
+            m_staging.resize((std::size_t)w * h * 4);
+            for (unsigned row = 0; row < h; ++row) {
+                std::memcpy(&m_staging[(std::size_t)row * w * 4],
+                    m_source.row(y + row) + x, (std::size_t)w * 4);
+            }
+            texture.update(m_staging.data(), w, h, x, y);
+        }
+        m_uploadedPixels += (std::size_t)w * h;
+    }
+
+public:
+    StreamingTexture() = default;
+
+    StreamingTexture(const StreamingTexture&) = delete;
+    StreamingTexture& operator=(const StreamingTexture&) = delete;
+
+    // The whole area starts dirty, so the first uploads fill the textures.
+    bool create(unsigned width, unsigned height, bool doubleBuffered = true) {
+        m_buffers = doubleBuffered ? 2 : 1;
+        for (unsigned i = 0; i < m_buffers; ++i)
+            if (!m_textures[i].create(width, height))
+                return false;
+        m_width = width;
+        m_height = height;
+        m_front = 0;
+        m_sprite.setTexture(m_textures[0], true);
+        markAllDirty();
+        return true;
+    }
+
+    // Uploads read from view, which must be at least width x height and
+    // outlive its use here; sf::Image storage works through PixelView(img).
+    void setSource(PixelView view) { m_source = view; }
+
+    void markDirty(const sf::IntRect& rect) {
+        int x0 = std::max(rect.left, 0);
+        int y0 = std::max(rect.top, 0);
+        int x1 = std::min(rect.left + rect.width, (int)m_width);
+        int y1 = std::min(rect.top + rect.height, (int)m_height);
+        if (x0 >= x1 || y0 >= y1)
+            return;
+        for (unsigned i = 0; i < m_buffers; ++i)
+            queue(m_pending[i], sf::IntRect(x0, y0, x1 - x0, y1 - y0));
+    }
+
+    void markAllDirty() {
+        for (unsigned i = 0; i < m_buffers; ++i) {
+            m_pending[i].clear();
+            if (m_width && m_height)
+                m_pending[i].push_back(sf::IntRect(0, 0, (int)m_width, (int)m_height));
+        }
+    }
+
+    bool pending() const {
+        for (unsigned i = 0; i < m_buffers; ++i)
+            if (!m_pending[i].empty())
+                return true;
+        return false;
+    }
+
+    // Brings the back texture up to date and makes it the front one.
+    // Returns the number of rectangles sent.
+    unsigned upload() {
+        if (m_buffers == 0 || m_source.empty())
+            return 0;
+        unsigned back = (m_front + 1) % m_buffers;
+        std::vector<sf::IntRect>& list = m_pending[back];
+        if (list.empty())
+            return 0;
+
+        for (const sf::IntRect& r : list)
+            uploadRect(m_textures[back], r);
+        unsigned uploads = (unsigned)list.size();
+        list.clear();
+
+        m_front = back;
+        m_sprite.setTexture(m_textures[m_front]);
+        return uploads;
+    }
+
+    std::size_t uploadedPixels() const { return m_uploadedPixels; }
+
+    sf::Vector2u size() const { return { m_width, m_height }; }
+    const sf::Texture& texture() const { return m_textures[m_front]; }
+    sf::Sprite& sprite() { return m_sprite; }
+
+    void setPosition(float x, float y) { m_sprite.setPosition(x, y); }
+
+    void draw(sf::RenderTarget& target) override {
+        upload();
+        target.draw(m_sprite);
+    }
+};
+
+// CPU-side render target: primitives write straight into an sf::Image and
+// only the tiles touched since the last upload are sent to the streaming
+// texture.
+class SoftwareFramebuffer : public DrawableObject {
+public:
+    static constexpr unsigned TileSize = 64;
+
+private:
+    sf::Image   m_image;
+    PixelView   m_view;
+    StreamingTexture m_stream;
+
+    unsigned m_tilesX{ 0 };
+    unsigned m_tilesY{ 0 };
+    std::vector<sf::Uint8> m_dirtyTiles;
+    std::vector<sf::Uint8> m_usedTiles;
+    bool m_anyDirty{ false };
+    sf::Uint32 m_clearColor{ 0 };
+
+    void markTile(unsigned tx, unsigned ty) {
+        std::size_t i = (std::size_t)ty * m_tilesX + tx;
+        m_dirtyTiles[i] = 1;
+        m_usedTiles[i] = 1;
+        m_anyDirty = true;
+    }
+
+public:
+    SoftwareFramebuffer() = default;
+
+    SoftwareFramebuffer(const SoftwareFramebuffer&) = delete;
+    SoftwareFramebuffer& operator=(const SoftwareFramebuffer&) = delete;
+
+    bool create(unsigned width, unsigned height,
+        sf::Color clearColor = sf::Color::Transparent) {
+        m_image.create(width, height, clearColor);
+        m_view = PixelView(m_image);
+        if (!m_stream.create(width, height))
+            return false;
+        m_stream.setSource(m_view);
+        m_clearColor = PixelView::pack(clearColor);
+
+        m_tilesX = (width + TileSize - 1) / TileSize;
+        m_tilesY = (height + TileSize - 1) / TileSize;
+        m_dirtyTiles.assign((std::size_t)m_tilesX * m_tilesY, 0);
+        m_usedTiles.assign((std::size_t)m_tilesX * m_tilesY, 0);
+        m_anyDirty = false;
+        return true;
+    }
+
+    sf::Vector2u size() const { return { m_view.width(), m_view.height() }; }
+
+    PixelView& view() { return m_view; }
+    const sf::Image& image() const { return m_image; }
+    const sf::Texture& texture() const { return m_stream.texture(); }
+    sf::Sprite& sprite() { return m_stream.sprite(); }
+    StreamingTexture& stream() { return m_stream; }
+
+    void setPosition(float x, float y) { m_stream.setPosition(x, y); }
+
+    // Clearing to the previous clear colour only rewrites tiles that were
+    // drawn into since then, so a sparse frame stays a sparse upload.
+    void clear(sf::Color color = sf::Color::Transparent) {
+        sf::Uint32 packed = PixelView::pack(color);
+        bool full = packed != m_clearColor;
+        m_clearColor = packed;
+
+        for (unsigned ty = 0; ty < m_tilesY; ++ty) {
+            for (unsigned tx = 0; tx < m_tilesX; ++tx) {
+                std::size_t i = (std::size_t)ty * m_tilesX + tx;
+                if (!full && !m_usedTiles[i])
+                    continue;
+                m_view.fillRect(sf::IntRect(tx * TileSize, ty * TileSize,
+                    TileSize, TileSize), packed);
+                m_dirtyTiles[i] = 1;
+                m_usedTiles[i] = 0;
+                m_anyDirty = true;
+            }
+        }
+    }
+
+    void setPixel(int x, int y, sf::Uint32 color) {
+        if (!m_view.contains(x, y))
+            return;
+        m_view.at(x, y) = color;
+        markTile(x / TileSize, y / TileSize);
+    }
+
+    void setPixel(int x, int y, sf::Color color) {
+        setPixel(x, y, PixelView::pack(color));
+    }
+
+    void markDirty(const sf::IntRect& rect) {
+        int x0 = std::max(rect.left, 0);
+        int y0 = std::max(rect.top, 0);
+        int x1 = std::min(rect.left + rect.width, (int)m_view.width());
+        int y1 = std::min(rect.top + rect.height, (int)m_view.height());
+        if (x0 >= x1 || y0 >= y1)
+            return;
+
+        for (int ty = y0 / (int)TileSize; ty <= (y1 - 1) / (int)TileSize; ++ty)
+            for (int tx = x0 / (int)TileSize; tx <= (x1 - 1) / (int)TileSize; ++tx)
+                markTile(tx, ty);
+    }
+
+    void fillSpan(int y, int x0, int x1, sf::Uint32 color) {
+        if (y < 0 || y >= (int)m_view.height())
+            return;
+        x0 = std::max(x0, 0);
+        x1 = std::min(x1, (int)m_view.width());
+        if (x0 >= x1)
+            return;
+
+        sf::Uint32* row = m_view.row(y);
+        std::fill(row + x0, row + x1, color);
+        for (int tx = x0 / (int)TileSize; tx <= (x1 - 1) / (int)TileSize; ++tx)
+            markTile(tx, y / TileSize);
+    }
+
+    // For writers that go through view() directly.
+    void markDirty(unsigned tx, unsigned ty) {
+        if (tx < m_tilesX && ty < m_tilesY)
+            markTile(tx, ty);
+    }
+
+    bool isDirty() const { return m_anyDirty; }
+
+    // Queues one rectangle per tile row, spanning the dirty tiles of that
+    // row, and uploads through the stream; full-width rows are sent
+    // straight from the image buffer.
+    unsigned upload() {
+        if (!m_anyDirty)
+            return m_stream.upload();
+
+        const unsigned width = m_view.width();
+        const unsigned height = m_view.height();
+
+        for (unsigned ty = 0; ty < m_tilesY; ++ty) {
+            sf::Uint8* row = &m_dirtyTiles[(std::size_t)ty * m_tilesX];
+            unsigned first = m_tilesX;
+            unsigned last = 0;
+            for (unsigned tx = 0; tx < m_tilesX; ++tx) {
+                if (row[tx]) {
+                    first = std::min(first, tx);
+                    last = tx;
+                    row[tx] = 0;
+                }
+            }
+            if (first == m_tilesX)
+                continue;
+
+            unsigned x = first * TileSize;
+            unsigned y = ty * TileSize;
+            unsigned w = std::min((last + 1) * TileSize, width) - x;
+            unsigned h = std::min(TileSize, height - y);
+            m_stream.markDirty(sf::IntRect((int)x, (int)y, (int)w, (int)h));
+        }
+
+        m_anyDirty = false;
+        return m_stream.upload();
+    }
+
+    void draw(sf::RenderTarget& target) override {
+        upload();
+        target.draw(m_stream.sprite());
+    }
+};
+
+class PrimitiveRenderer {
+public:
+    enum class PixelMode {
+        Immediate,
+        BatchedPerPrimitive,
+        BatchedPerFrame
+    };
+
+    enum class RasterMode {
+        Float,
+        Integer
+    };
+
+    enum class FillRule {
+        EvenOdd,
+        NonZero
+    };
+
+private:
+    friend class TiledRasterizer;
+
+    PixelMode m_pixelMode{ PixelMode::Immediate };
+    RasterMode m_rasterMode{ RasterMode::Float };
+    sf::VertexArray m_batch{ sf::Points };
+    sf::VertexArray m_spanBatch{ sf::Triangles };
+    sf::RenderTarget* m_batchTarget{ nullptr };
+    Profiler* m_profiler{ nullptr };
+
+    struct OutlineKey {
+        enum Kind { Circle, Ellipse };
+        int kind;
+        unsigned int steps;
+        float rx;
+        float ry;
+
+        bool operator==(const OutlineKey& o) const {
+            return kind == o.kind && steps == o.steps && rx == o.rx && ry == o.ry;
+        }
+    };
+
+    struct OutlineKeyHash {
+        std::size_t operator()(const OutlineKey& k) const {
+            std::uint32_t bx, by;
+            std::memcpy(&bx, &k.rx, sizeof(bx));
+            std::memcpy(&by, &k.ry, sizeof(by));
+            std::uint64_t h = 1469598103934665603ull;
+            for (std::uint64_t v : { (std::uint64_t)k.kind, (std::uint64_t)k.steps,
+                (std::uint64_t)bx, (std::uint64_t)by })
+                h = (h ^ v) * 1099511628211ull;
+            return (std::size_t)h;
+        }
+    };
+
+    static constexpr std::size_t MaxOutlineCacheEntries = 256;
+    static constexpr std::size_t MaxArcCacheEntries = 64;
+    std::unordered_map<OutlineKey, std::vector<sf::Vector2i>, OutlineKeyHash> m_outlineCache;
+    std::unordered_map<unsigned int, std::vector<sf::Vector2f>> m_circleArcs;
+    std::unordered_map<unsigned int, std::vector<sf::Vector2f>> m_ellipseArcs;
+
+    void countDraw(std::size_t vertices) {
+        if (m_profiler)
+            m_profiler->countDraw(vertices);
+    }
+
+    // Pixels and spans batch separately, so switching from one to the
+    // other draws what is pending first to keep submission order.
+    void drawBatch(sf::RenderTarget& target, sf::VertexArray& batch) {
+        if (batch.getVertexCount() == 0)
+            return;
+        target.draw(batch);
+        countDraw(batch.getVertexCount());
+        batch.clear();
+    }
+
+    void putPixel(sf::RenderTarget& target, int x, int y, sf::Color color) {
+        sf::Vertex v(sf::Vector2f(static_cast<float>(x),
+            static_cast<float>(y)), color);
+
+        if (m_pixelMode == PixelMode::Immediate) {
+            target.draw(&v, 1, sf::Points);
+            countDraw(1);
+            return;
+        }
+
+        if (m_batchTarget && m_batchTarget != &target)
+            flush(*m_batchTarget);
+        m_batchTarget = &target;
+        drawBatch(target, m_spanBatch);
+        m_batch.append(v);
+    }
+
+    // A span covers pixels [x0, x1) of row y as a one-pixel-high quad.
+    void putSpan(sf::RenderTarget& target, int y, int x0, int x1, sf::Color color) {
+        float l = (float)x0;
+        float r = (float)x1;
+        float t = (float)y;
+        float b = (float)(y + 1);
+        sf::Vertex quad[6] = {
+            sf::Vertex(sf::Vector2f(l, t), color),
+            sf::Vertex(sf::Vector2f(r, t), color),
+            sf::Vertex(sf::Vector2f(r, b), color),
+            sf::Vertex(sf::Vector2f(l, t), color),
+            sf::Vertex(sf::Vector2f(r, b), color),
+            sf::Vertex(sf::Vector2f(l, b), color)
+        };
+
+        if (m_pixelMode == PixelMode::Immediate) {
+            target.draw(quad, 6, sf::Triangles);
+            countDraw(6);
+            return;
+        }
+
+        if (m_batchTarget && m_batchTarget != &target)
+            flush(*m_batchTarget);
+        m_batchTarget = &target;
+        drawBatch(target, m_batch);
+        for (const sf::Vertex& v : quad)
+            m_spanBatch.append(v);
+    }
+
+    void endPrimitive(sf::RenderTarget& target) {
+        if (m_pixelMode == PixelMode::BatchedPerPrimitive)
+            flush(target);
+    }
+
+    auto targetPlot(sf::RenderTarget& target, sf::Color color) {
+        return [this, &target, color](int x, int y) {
+            putPixel(target, x, y, color);
+        };
+    }
+
+    static auto queuePlot(RenderQueue& queue, sf::Color color, int layer) {
+        return [&queue, color, layer](int x, int y) {
+            sf::Vertex v(sf::Vector2f((float)x, (float)y), color);
+            queue.add(&v, 1, sf::Points, layer);
+        };
+    }
+
+    static auto framebufferPlot(SoftwareFramebuffer& fb, sf::Color color) {
+        sf::Uint32 packed = PixelView::pack(color);
+        return [&fb, packed](int x, int y) {
+            fb.setPixel(x, y, packed);
+        };
+    }
+
+    template <typename Plot>
+    void rasterLine(const sf::Vector2f& a, const sf::Vector2f& b, Plot plot) {
+        if (m_rasterMode == RasterMode::Integer)
+            rasterLineBresenham(a, b, plot);
+        else
+            rasterLineDDA(a, b, plot);
+    }
+
+    const std::vector<sf::Vector2f>& cachedArc(
+        std::unordered_map<unsigned int, std::vector<sf::Vector2f>>& cache,
+        unsigned int steps, float span) {
+        auto it = cache.find(steps);
+        if (it == cache.end()) {
+            if (cache.size() >= MaxArcCacheEntries)
+                cache.clear();
+            it = cache.emplace(steps, unitArc(steps, span)).first;
+        }
+        return it->second;
+    }
+
+    // Step-rasterized outlines, stored relative to the origin without
+    // duplicates and translated by whole pixels, so only integral centres
+    // use them; others just reuse the trig table. snap() adds the centre's
+    // integer part after rounding, so a translated outline is exactly what
+    // rasterizing at that centre draws. The midpoint rasterizers are
+    // cheaper than a lookup and are not cached.
+    template <typename Build, typename Plot>
+    void plotOutline(const OutlineKey& key, int cx, int cy, Build build, Plot plot) {
+        auto it = m_outlineCache.find(key);
+        if (it == m_outlineCache.end()) {
+            if (m_outlineCache.size() >= MaxOutlineCacheEntries)
+                m_outlineCache.clear();
+            std::vector<sf::Vector2i> pts;
+            build([&pts](int x, int y) { pts.emplace_back(x, y); });
+            std::sort(pts.begin(), pts.end(), [](const sf::Vector2i& a, const sf::Vector2i& b) {
+                return a.y != b.y ? a.y < b.y : a.x < b.x;
+            });
+            pts.erase(std::unique(pts.begin(), pts.end()), pts.end());
+            it = m_outlineCache.emplace(key, std::move(pts)).first;
+        }
+        for (const sf::Vector2i& p : it->second)
+            plot(cx + p.x, cy + p.y);
+    }
+
+    static bool integral(const sf::Vector2f& p) {
+        return p.x == std::floor(p.x) && p.y == std::floor(p.y) &&
+            std::fabs(p.x) < 1e7f && std::fabs(p.y) < 1e7f;
+    }
+
+    template <typename Plot>
+    void rasterCircle(const sf::Vector2f& center, float R,
+        unsigned int steps, Plot plot) {
+        if (m_rasterMode == RasterMode::Integer) {
+            rasterCircleMidpoint(center, R, plot);
+            return;
+        }
+
+        const std::vector<sf::Vector2f>& arc = cachedArc(m_circleArcs, steps, 3.14159265359f / 4.f);
+        if (!integral(center)) {
+            rasterCircleSteps(center, R, arc, plot);
+            return;
+        }
+        float r = std::fabs(R);
+        plotOutline(OutlineKey{ OutlineKey::Circle, steps, r, r },
+            (int)center.x, (int)center.y,
+            [&](auto p) { rasterCircleSteps(sf::Vector2f(0.f, 0.f), r, arc, p); }, plot);
+    }
+
+    template <typename Plot>
+    void rasterEllipse(const sf::Vector2f& center, float Rx, float Ry,
+        unsigned int steps, Plot plot) {
+        if (m_rasterMode == RasterMode::Integer) {
+            rasterEllipseMidpoint(center, Rx, Ry, plot);
+            return;
+        }
+
+        const std::vector<sf::Vector2f>& arc = cachedArc(m_ellipseArcs, steps, 3.14159265359f / 2.f);
+        if (!integral(center)) {
+            rasterEllipseSteps(center, Rx, Ry, arc, plot);
+            return;
+        }
+        float rx = std::fabs(Rx);
+        float ry = std::fabs(Ry);
+        plotOutline(OutlineKey{ OutlineKey::Ellipse, steps, rx, ry },
+            (int)center.x, (int)center.y,
+            [&](auto p) { rasterEllipseSteps(sf::Vector2f(0.f, 0.f), rx, ry, arc, p); }, plot);
+    }
+
+    template <typename Plot>
+    void rasterPolygon(const std::vector<sf::Vector2f>& pts, Plot plot) {
+        std::size_t n = pts.size();
+        for (std::size_t i = 0; i < n; ++i)
+            rasterLine(pts[i], pts[(i + 1) % n], plot);
+    }
+
+    struct FillEdge {
+        int yStart;
+        int yEnd;
+        float ax;
+        float ay;
+        float dxdy;
+        int winding;
+        float x;
+    };
+
+    std::vector<FillEdge> m_fillEdges;
+    std::vector<FillEdge> m_activeEdges;
+
+    // Crossing of row y, evaluated from the edge's upper end rather than
+    // accumulated row by row, so any band of rows can be filled on its own.
+    static float edgeX(const FillEdge& e, int y) {
+        return e.ax + ((float)y + 0.5f - e.ay) * e.dxdy;
+    }
+
+    // Appends the edges of pts that cross at least one pixel centre row,
+    // sorted by their first row.
+    static void appendFillEdges(const std::vector<sf::Vector2f>& pts,
+        std::vector<FillEdge>& edges) {
+        const std::size_t n = pts.size();
+        if (n < 3)
+            return;
+
+        const std::size_t first = edges.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            sf::Vector2f a = pts[i];
+            sf::Vector2f b = pts[(i + 1) % n];
+            int winding = 1;
+            if (a.y > b.y) {
+                std::swap(a, b);
+                winding = -1;
+            }
+            int y0 = (int)std::ceil(a.y - 0.5f);
+            int y1 = (int)std::ceil(b.y - 0.5f);
+            if (y0 >= y1)
+                continue;
+
+            float dxdy = (b.x - a.x) / (b.y - a.y);
+            edges.push_back({ y0, y1, a.x, a.y, dxdy, winding, a.x });
+        }
+        std::sort(edges.begin() + first, edges.end(), [](const FillEdge& a, const FillEdge& b) {
+            return a.yStart < b.yStart;
+        });
+    }
+
+    // Scanline fill of rows [yBegin, yEnd) sampled at pixel centres. edges
+    // are sorted by first row and active is scratch. Emits span(y, x0, x1)
+    // for every covered run [x0, x1) of row y.
+    template <typename Span>
+    static void fillRows(const FillEdge* edges, std::size_t count, int yBegin, int yEnd,
+        FillRule rule, std::vector<FillEdge>& active, Span span) {
+        active.clear();
+        std::size_t next = 0;
+        for (int y = yBegin; y < yEnd; ++y) {
+            for (; next < count && edges[next].yStart <= y; ++next)
+                if (edges[next].yEnd > y)
+                    active.push_back(edges[next]);
+
+            active.erase(std::remove_if(active.begin(), active.end(),
+                [y](const FillEdge& e) { return e.yEnd <= y; }),
+                active.end());
+            if (active.empty() && next == count)
+                break;
+
+            for (FillEdge& e : active)
+                e.x = edgeX(e, y);
+            for (std::size_t i = 1; i < active.size(); ++i) {
+                FillEdge e = active[i];
+                std::size_t j = i;
+                while (j > 0 && active[j - 1].x > e.x) {
+                    active[j] = active[j - 1];
+                    --j;
+                }
+                active[j] = e;
+            }
+
+            int winding = 0;
+            for (std::size_t i = 0; i + 1 < active.size(); ++i) {
+                if (rule == FillRule::EvenOdd)
+                    winding ^= 1;
+                else
+                    winding += active[i].winding;
+                if (winding == 0)
+                    continue;
+
+                int x0 = (int)std::ceil(active[i].x - 0.5f);
+                int x1 = (int)std::ceil(active[i + 1].x - 0.5f);
+                if (x0 < x1)
+                    span(y, x0, x1);
+            }
+        }
+    }
+
+    // Edge-table scanline fill sampled at pixel centres. Emits span(y, x0, x1)
+    // for every covered run [x0, x1) of row y, for rows in [yMin, yMax);
+    // rows outside are skipped, not walked.
+    template <typename Span>
+    void rasterPolygonFill(const std::vector<sf::Vector2f>& pts,
+        FillRule rule, Span span,
+        int yMin = std::numeric_limits<int>::min(),
+        int yMax = std::numeric_limits<int>::max()) {
+        m_fillEdges.clear();
+        appendFillEdges(pts, m_fillEdges);
+        if (m_fillEdges.empty())
+            return;
+
+        int yLast = m_fillEdges.front().yEnd;
+        for (const FillEdge& e : m_fillEdges)
+            yLast = std::max(yLast, e.yEnd);
+        fillRows(m_fillEdges.data(), m_fillEdges.size(),
+            std::max(m_fillEdges.front().yStart, yMin), std::min(yLast, yMax),
+            rule, m_activeEdges, span);
+    }
+
+    // The static rasterizers below take an optional clip rect. With one
+    // they plot only the pixels inside it, and reach them without walking
+    // the rest of the primitive where they can, so a tile can rasterize
+    // its own part and still get the pixels of the unclipped primitive.
+
+    // Steps before the clip are accumulated without plotting, since y is
+    // a running sum.
+    template <typename Plot>
+    static void rasterLineDDA(const sf::Vector2f& a, const sf::Vector2f& b,
+        Plot plot, const sf::IntRect* clip = nullptr) {
+        float x0 = a.x;
+        float y0 = a.y;
+        float x1 = b.x;
+        float y1 = b.y;
+
+        float dx = x1 - x0;
+        float dy = y1 - y0;
+
+        if (dx == 0 && dy == 0) {
+            int px = (int)std::round(x0);
+            int py = (int)std::round(y0);
+            if (!clip || clip->contains(px, py))
+                plot(px, py);
+            return;
+        }
+
+        bool steep = std::fabs(dy) > std::fabs(dx);
+        if (steep) {
+            std::swap(x0, y0);
+            std::swap(x1, y1);
+            std::swap(dx, dy);
+        }
+
+        if (x0 > x1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+            dx = x1 - x0;
+            dy = y1 - y0;
+        }
+
+        float m = (dx == 0) ? 0.f : dy / dx;
+        float y = y0;
+
+        int first = (int)std::round(x0);
+        int last = (int)std::round(x1);
+        if (clip) {
+            int lo = steep ? clip->top : clip->left;
+            int hi = lo + (steep ? clip->height : clip->width) - 1;
+            if (lo > last || hi < first)
+                return;
+            for (; first < lo; ++first)
+                y += m;
+            last = std::min(last, hi);
+        }
+
+        for (int x = first; x <= last; ++x) {
+            int px = steep ? (int)std::round(y) : x;
+            int py = steep ? x : (int)std::round(y);
+            if (!clip || clip->contains(px, py))
+                plot(px, py);
+            y += m;
+        }
+    }
+
+    // (cos, sin) at steps + 1 evenly spaced angles over [0, span].
+    static std::vector<sf::Vector2f> unitArc(unsigned int steps, float span) {
+        std::vector<sf::Vector2f> arc;
+        arc.reserve(steps + 1);
+        for (unsigned int i = 0; i <= steps; ++i) {
+            float alpha = span * (float)i / (float)steps;
+            arc.emplace_back(std::cos(alpha), std::sin(alpha));
+        }
+        return arc;
+    }
+
+    // Nearest pixel to base + frac + offset, rounding halves up. Only the
+    // fraction takes part in the float sum, so translating by whole pixels
+    // never changes which pixel is chosen.
+    static int snap(int base, float frac, float offset) {
+        return base + (int)std::floor(frac + offset + 0.5f);
+    }
+
+    // Plots mirror k of the arc points, in arc order, for every mirror in
+    // the table: (dx, dy) is (x, y), or (y, x) when swapped, times the
+    // signs. A clip skips the mirrors whose end points are more than a
+    // pixel away from it; the arc between them is monotonic.
+    template <std::size_t Mirrors, typename Plot>
+    static void plotArc(const sf::Vector2f& center, float rx, float ry,
+        const std::vector<sf::Vector2f>& arc,
+        const bool (&swapped)[Mirrors], const float (&sx)[Mirrors], const float (&sy)[Mirrors],
+        Plot plot, const sf::IntRect* clip) {
+        if (arc.empty())
+            return;
+        int ix = (int)std::floor(center.x);
+        int iy = (int)std::floor(center.y);
+        float fx = center.x - (float)ix;
+        float fy = center.y - (float)iy;
+
+        auto point = [&](const sf::Vector2f& u, std::size_t k) {
+            float x = rx * u.x;
+            float y = ry * u.y;
+            return sf::Vector2i(snap(ix, fx, sx[k] * (swapped[k] ? y : x)),
+                snap(iy, fy, sy[k] * (swapped[k] ? x : y)));
+        };
+
+        unsigned mask = (1u << Mirrors) - 1;
+        if (clip) {
+            for (std::size_t k = 0; k < Mirrors; ++k) {
+                sf::Vector2i p = point(arc.front(), k);
+                sf::Vector2i q = point(arc.back(), k);
+                sf::IntRect bounds(std::min(p.x, q.x) - 1, std::min(p.y, q.y) - 1,
+                    std::abs(p.x - q.x) + 3, std::abs(p.y - q.y) + 3);
+                if (!bounds.intersects(*clip))
+                    mask &= ~(1u << k);
+            }
+        }
+
+        for (const sf::Vector2f& u : arc) {
+            for (std::size_t k = 0; k < Mirrors; ++k) {
+                if (!(mask >> k & 1))
+                    continue;
+                sf::Vector2i p = point(u, k);
+                if (!clip || clip->contains(p))
+                    plot(p.x, p.y);
+            }
+        }
+    }
+
+    // arc is unitArc(steps, pi / 4): one octant, mirrored eight ways.
+    template <typename Plot>
+    static void rasterCircleSteps(const sf::Vector2f& center, float R,
+        const std::vector<sf::Vector2f>& arc, Plot plot, const sf::IntRect* clip = nullptr) {
+        static const bool swapped[8] = { false, true, false, true, false, true, false, true };
+        static const float sx[8] = { 1.f, 1.f, -1.f, -1.f, -1.f, -1.f, 1.f, 1.f };
+        static const float sy[8] = { 1.f, 1.f, 1.f, 1.f, -1.f, -1.f, -1.f, -1.f };
+        plotArc(center, R, R, arc, swapped, sx, sy, plot, clip);
+    }
+
+    // arc is unitArc(steps, pi / 2): one quadrant, mirrored four ways.
+    template <typename Plot>
+    static void rasterEllipseSteps(const sf::Vector2f& center,
+        float Rx, float Ry, const std::vector<sf::Vector2f>& arc, Plot plot,
+        const sf::IntRect* clip = nullptr) {
+        static const bool swapped[4] = { false, false, false, false };
+        static const float sx[4] = { 1.f, -1.f, 1.f, -1.f };
+        static const float sy[4] = { 1.f, 1.f, -1.f, -1.f };
+        plotArc(center, Rx, Ry, arc, swapped, sx, sy, plot, clip);
+    }
+
+    // Minor-axis steps taken after k major-axis steps of a line spanning
+    // major and minor pixels, major >= minor.
+    static long long bresenhamMinor(long long k, long long major, long long minor) {
+        return minor == 0 ? 0 : (2 * minor * k + major) / (2 * major);
+    }
+
+    // A clip starts the loop at its first column (or row, for steep lines)
+    // with the error term the loop would have there.
+    template <typename Plot>
+    static void rasterLineBresenham(const sf::Vector2f& a, const sf::Vector2f& b,
+        Plot plot, const sf::IntRect* clip = nullptr) {
+        int x0 = (int)std::round(a.x);
+        int y0 = (int)std::round(a.y);
+        int x1 = (int)std::round(b.x);
+        int y1 = (int)std::round(b.y);
+
+        int dx = std::abs(x1 - x0);
+        int dy = -std::abs(y1 - y0);
+        int sx = x0 < x1 ? 1 : -1;
+        int sy = y0 < y1 ? 1 : -1;
+        int err = dx + dy;
+
+        const bool steep = -dy > dx;
+        long long first = 0;
+        long long last = steep ? -dy : dx;
+        if (clip) {
+            int origin = steep ? y0 : x0;
+            int step = steep ? sy : sx;
+            int lo = steep ? clip->top : clip->left;
+            int hi = lo + (steep ? clip->height : clip->width) - 1;
+            first = std::max(first, (long long)(step > 0 ? lo - origin : origin - hi));
+            last = std::min(last, (long long)(step > 0 ? hi - origin : origin - lo));
+            if (first > last)
+                return;
+
+            long long D = -dy;
+            long long minor = steep ? bresenhamMinor(first, D, dx) : bresenhamMinor(first, dx, D);
+            long long xSteps = steep ? minor : first;
+            long long ySteps = steep ? first : minor;
+            x0 += sx * (int)xSteps;
+            y0 += sy * (int)ySteps;
+            err = (int)(dx * (1 + ySteps) - D * (1 + xSteps));
+        }
+
+        for (long long k = first; ; ++k) {
+            if (!clip || clip->contains(x0, y0))
+                plot(x0, y0);
+            if (k == last)
+                break;
+            int e2 = 2 * err;
+            if (e2 >= dy) {
+                err += dy;
+                x0 += sx;
+            }
+            if (e2 <= dx) {
+                err += dx;
+                y0 += sy;
+            }
+        }
+    }
+
+    // Outer pixel row of the midpoint circle at column x, 0 <= x <= r.
+    static long long midpointCircleY(long long r2, long long x) {
+        long long q = r2 - x * x;
+        long long y = (long long)std::floor(std::sqrt((double)q) + 0.5);
+        while (y > 0 && y * (y - 1) >= q)
+            --y;
+        while ((y + 1) * y < q)
+            ++y;
+        return y;
+    }
+
+    // A clip plots each octant mirror over the columns (or rows) it has in
+    // the clip, from the closed form of the loop's y.
+    template <typename Plot>
+    static void rasterCircleMidpoint(const sf::Vector2f& center, float R,
+        Plot plot, const sf::IntRect* clip = nullptr) {
+        int cx = (int)std::round(center.x);
+        int cy = (int)std::round(center.y);
+        int r = (int)std::round(std::fabs(R));
+
+        if (r == 0) {
+            if (!clip || clip->contains(cx, cy))
+                plot(cx, cy);
+            return;
+        }
+
+        if (clip) {
+            const long long r2 = (long long)r * r;
+            // The loop runs while x <= y.
+            long long lo = 0;
+            long long hi = r;
+            while (lo < hi) {
+                long long mid = (lo + hi + 1) / 2;
+                if (mid <= midpointCircleY(r2, mid))
+                    lo = mid;
+                else
+                    hi = mid - 1;
+            }
+            const long long xEnd = lo;
+
+            const int left = clip->left - cx;
+            const int right = clip->left + clip->width - 1 - cx;
+            const int top = clip->top - cy;
+            const int bottom = clip->top + clip->height - 1 - cy;
+            for (int k = 0; k < 8; ++k) {
+                const bool swapped = (k & 4) != 0;
+                const int sx = (k & 1) ? -1 : 1;
+                const int sy = (k & 2) ? -1 : 1;
+                // x runs along the axis it is plotted on.
+                int along0 = swapped ? top : left;
+                int along1 = swapped ? bottom : right;
+                int across0 = swapped ? left : top;
+                int across1 = swapped ? right : bottom;
+                int s = swapped ? sy : sx;
+                int t = swapped ? sx : sy;
+                long long xFirst = std::max(0LL, (long long)(s > 0 ? along0 : -along1));
+                long long xLast = std::min(xEnd, (long long)(s > 0 ? along1 : -along0));
+                for (long long x = xFirst; x <= xLast; ++x) {
+                    long long y = t * midpointCircleY(r2, x);
+                    if (y < across0 || y > across1)
+                        continue;
+                    int px = (int)(swapped ? y : s * x);
+                    int py = (int)(swapped ? s * x : y);
+                    plot(cx + px, cy + py);
+                }
+            }
+            return;
+        }
+
+        int x = 0;
+        int y = r;
+        int d = 1 - r;
+
+        while (x <= y) {
+            // Octant mirrors coincide on the axes and on the diagonal.
+            if (x == 0) {
+                plot(cx, cy + y);
+                plot(cx, cy - y);
+                plot(cx + y, cy);
+                plot(cx - y, cy);
+            }
+            else if (x == y) {
+                plot(cx + x, cy + y);
+                plot(cx - x, cy + y);
+                plot(cx + x, cy - y);
+                plot(cx - x, cy - y);
+            }
+            else {
+                plot(cx + x, cy + y);
+                plot(cx - x, cy + y);
+                plot(cx + x, cy - y);
+                plot(cx - x, cy - y);
+                plot(cx + y, cy + x);
+                plot(cx - y, cy + x);
+                plot(cx + y, cy - x);
+                plot(cx - y, cy - x);
+            }
+
+            if (d < 0) {
+                d += 2 * x + 3;
+            }
+            else {
+                d += 2 * (x - y) + 5;
+                --y;
+            }
+            ++x;
+        }
+    }
+
+    // Upper region of the midpoint ellipse: the pixel row at column x.
+    static long long midpointEllipseY(long long rx2, long long ry2, long long x) {
+        const long long q = 4 * ry2 * (rx2 - x * x);
+        auto inside = [&](long long y) { return rx2 * (2 * y - 1) * (2 * y - 1) < q; };
+        long long y = (long long)std::floor(std::sqrt((double)ry2 * (1.0 - (double)(x * x) / (double)rx2)) + 0.5) + 1;
+        while (y > 0 && !inside(y))
+            --y;
+        while (inside(y + 1))
+            ++y;
+        return y;
+    }
+
+    // Lower region: the first column whose right midpoint on row y lies
+    // outside the ellipse.
+    static long long midpointEllipseX(long long rx2, long long ry2, long long y) {
+        const long long q = 4 * rx2 * (ry2 - y * y);
+        auto inside = [&](long long x) { return ry2 * (2 * x + 1) * (2 * x + 1) <= q; };
+        long long x = (long long)std::floor((std::sqrt(std::max(0.0, (double)q / (double)ry2)) - 1.0) / 2.0);
+        x = std::max(x, 0LL);
+        while (x > 0 && !inside(x - 1))
+            --x;
+        while (inside(x))
+            ++x;
+        return x;
+    }
+
+    // A clip plots each quadrant mirror from closed forms of the two
+    // regions: the upper region over its columns in the clip, the lower
+    // over its rows. The lower region starts where the upper one hands
+    // over and catches up with the outline by at most a column per row.
+    template <typename Plot>
+    static void rasterEllipseMidpoint(const sf::Vector2f& center,
+        float Rx, float Ry, Plot plot, const sf::IntRect* clip = nullptr) {
+        int cx = (int)std::round(center.x);
+        int cy = (int)std::round(center.y);
+        int rx = (int)std::round(std::fabs(Rx));
+        int ry = (int)std::round(std::fabs(Ry));
+
+        if (rx == 0 || ry == 0) {
+            int x0 = -rx;
+            int x1 = rx;
+            int y0 = -ry;
+            int y1 = ry;
+            if (clip) {
+                x0 = std::max(x0, clip->left - cx);
+                x1 = std::min(x1, clip->left + clip->width - 1 - cx);
+                y0 = std::max(y0, clip->top - cy);
+                y1 = std::min(y1, clip->top + clip->height - 1 - cy);
+            }
+            for (int x = x0; x <= x1; ++x)
+                for (int y = y0; y <= y1; ++y)
+                    plot(cx + x, cy + y);
+            return;
+        }
+
+        // Decision variables are scaled by 4 to stay integral.
+        const long long rx2 = (long long)rx * rx;
+        const long long ry2 = (long long)ry * ry;
+
+        if (clip) {
+            // The upper region plots columns [0, x1) and ends at the first
+            // column where ry^2 x >= rx^2 y.
+            long long lo = 0;
+            long long hi = rx;
+            while (lo < hi) {
+                long long mid = (lo + hi) / 2;
+                if (ry2 * mid >= rx2 * midpointEllipseY(rx2, ry2, mid))
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            const long long x1 = lo;
+            long long y1 = ry;
+            if (x1 > 0) {
+                y1 = midpointEllipseY(rx2, ry2, x1 - 1);
+                if (4 * ry2 * x1 * x1 + rx2 * (2 * y1 - 1) * (2 * y1 - 1) >= 4 * rx2 * ry2)
+                    --y1;
+            }
+
+            const int left = clip->left - cx;
+            const int right = clip->left + clip->width - 1 - cx;
+            const int top = clip->top - cy;
+            const int bottom = clip->top + clip->height - 1 - cy;
+            for (int k = 0; k < 4; ++k) {
+                const int sx = (k & 1) ? -1 : 1;
+                const int sy = (k & 2) ? -1 : 1;
+                long long xFirst = std::max(0LL, (long long)(sx > 0 ? left : -right));
+                long long xLast = std::min(x1 - 1, (long long)(sx > 0 ? right : -left));
+                for (long long x = xFirst; x <= xLast; ++x) {
+                    long long y = sy * midpointEllipseY(rx2, ry2, x);
+                    if (y >= top && y <= bottom)
+                        plot(cx + (int)(sx * x), cy + (int)y);
+                }
+
+                long long yFirst = std::max(0LL, (long long)(sy > 0 ? top : -bottom));
+                long long yLast = std::min(y1, (long long)(sy > 0 ? bottom : -top));
+                for (long long y = yFirst; y <= yLast; ++y) {
+                    long long x = y == y1 ? x1
+                        : std::min(x1 + (y1 - y), std::max(x1, midpointEllipseX(rx2, ry2, y)));
+                    x *= sx;
+                    if (x >= left && x <= right)
+                        plot(cx + (int)x, cy + (int)(sy * y));
+                }
+            }
+            return;
+        }
+
+        auto plot4 = [&](long long x, long long y) {
+            int ix = (int)x;
+            int iy = (int)y;
+            plot(cx + ix, cy + iy);
+            if (ix != 0)
+                plot(cx - ix, cy + iy);
+            if (iy != 0) {
+                plot(cx + ix, cy - iy);
+                if (ix != 0)
+                    plot(cx - ix, cy - iy);
+            }
+        };
+
+        long long x = 0;
+        long long y = ry;
+        long long px = 0;
+        long long py = 2 * rx2 * y;
+
+        long long d1 = 4 * ry2 - 4 * rx2 * ry + rx2;
+        while (px < py) {
+            plot4(x, y);
+            ++x;
+            px += 2 * ry2;
+            if (d1 < 0) {
+                d1 += 4 * (px + ry2);
+            }
+            else {
+                --y;
+                py -= 2 * rx2;
+                d1 += 4 * (px - py + ry2);
+            }
+        }
+
+        long long d2 = ry2 * (2 * x + 1) * (2 * x + 1)
+            + 4 * rx2 * (y - 1) * (y - 1) - 4 * rx2 * ry2;
+        while (y >= 0) {
+            plot4(x, y);
+            --y;
+            py -= 2 * rx2;
+            if (d2 > 0) {
+                d2 += 4 * (rx2 - py);
+            }
+            else {
+                ++x;
+                px += 2 * ry2;
+                d2 += 4 * (px - py + rx2);
+            }
+        }
+    }
+
+    struct FillSpan {
+        int x1;
+        int x2;
+        int y;
+        int dy;
+    };
+
+    std::vector<FillSpan> m_fillStack;
+    // FIFO for the queue fills; m_fillHead is the next element to pop.
+    std::vector<sf::Vector2i> m_fillQueue;
+    std::size_t m_fillHead{ 0 };
+    FrameArena* m_frameArena{ nullptr };
+
+    void pushFill(int x, int y) {
+        m_fillQueue.push_back({ x, y });
+    }
+
+    bool popFill(sf::Vector2i& p) {
+        if (m_fillHead == m_fillQueue.size())
+            return false;
+        p = m_fillQueue[m_fillHead++];
+        // Drop the consumed front once it is most of the buffer, so the
+        // buffer stays near the live queue size.
+        if (m_fillHead >= 4096 && m_fillHead * 2 >= m_fillQueue.size()) {
+            m_fillQueue.erase(m_fillQueue.begin(), m_fillQueue.begin() + m_fillHead);
+            m_fillHead = 0;
+        }
+        return true;
+    }
+
+    void resetFillQueue(int x, int y) {
+        m_fillQueue.clear();
+        m_fillHead = 0;
+        pushFill(x, y);
+    }
+
+    // The vertices are kept so a hash collision is not taken for a hit.
+    struct SimpleEntry {
+        std::vector<sf::Vector2f> points;
+        bool simple;
+    };
+
+    static constexpr std::size_t MaxSimpleCacheEntries = 256;
+    std::unordered_map<std::uint64_t, SimpleEntry> m_simpleCache;
+
+    static std::uint64_t hashVertices(const std::vector<sf::Vector2f>& pts) {
+        std::uint64_t h = 1469598103934665603ull ^ pts.size();
+        for (const sf::Vector2f& p : pts) {
+            std::uint32_t bits[2];
+            std::memcpy(&bits[0], &p.x, sizeof(float));
+            std::memcpy(&bits[1], &p.y, sizeof(float));
+            for (std::uint32_t b : bits) {
+                h ^= b;
+                h *= 1099511628211ull;
+            }
+        }
+        return h;
+    }
+
+    // Span (scanline) seed fill: fills whole horizontal runs and only
+    // pushes one seed span per run above/below instead of one per pixel.
+    // `inside` must turn false once a pixel has been set to fill.
+    template <typename Inside>
+    void scanlineFill(PixelView view, int x, int y,
+        sf::Uint32 fill, Inside inside) {
+        const int w = (int)view.width();
+        const int h = (int)view.height();
+
+        if (!view.contains(x, y) || !inside(view.at(x, y)))
+            return;
+
+        m_fillStack.clear();
+        m_fillStack.push_back({ x, x, y, 1 });
+        m_fillStack.push_back({ x, x, y - 1, -1 });
+
+        while (!m_fillStack.empty()) {
+            FillSpan s = m_fillStack.back();
+            m_fillStack.pop_back();
+
+            if (s.y < 0 || s.y >= h)
+                continue;
+
+            sf::Uint32* row = view.row(s.y);
+            auto test = [&](int px) {
+                return px >= 0 && px < w && inside(row[px]);
+            };
+
+            int x1 = s.x1;
+            int lx = x1;
+            if (test(lx)) {
+                while (test(lx - 1)) {
+                    row[lx - 1] = fill;
+                    --lx;
+                }
+                if (lx < x1)
+                    m_fillStack.push_back({ lx, x1 - 1, s.y - s.dy, -s.dy });
+            }
+
+            while (x1 <= s.x2) {
+                while (test(x1)) {
+                    row[x1] = fill;
+                    ++x1;
+                }
+                if (x1 > lx)
+                    m_fillStack.push_back({ lx, x1 - 1, s.y + s.dy, s.dy });
+                if (x1 - 1 > s.x2)
+                    m_fillStack.push_back({ s.x2 + 1, x1 - 1, s.y - s.dy, -s.dy });
+                ++x1;
+                while (x1 < s.x2 && !test(x1))
+                    ++x1;
+                lx = x1;
+            }
+        }
+    }
+
+public:
+    PrimitiveRenderer() = default;
+
+    void setPixelMode(PixelMode mode) {
+        if (m_batchTarget)
+            flush(*m_batchTarget);
+        m_pixelMode = mode;
+    }
+
+    PixelMode pixelMode() const { return m_pixelMode; }
+
+    void setRasterMode(RasterMode mode) { m_rasterMode = mode; }
+    RasterMode rasterMode() const { return m_rasterMode; }
+
+    // Public draw and fill calls are timed as sections of this profiler.
+    void setProfiler(Profiler* profiler) { m_profiler = profiler; }
+
+    // Scratch memory for work that does not outlive the frame, such as
+    // the polygon sweep on a cache miss. The owner resets it.
+    void setFrameArena(FrameArena* arena) { m_frameArena = arena; }
+    FrameArena* frameArena() const { return m_frameArena; }
+
+    std::size_t pendingPixels() const { return m_batch.getVertexCount(); }
+    std::size_t pendingSpans() const { return m_spanBatch.getVertexCount() / 6; }
+
+    // Draws whatever is batched for the target. Pixels and spans are drawn
+    // in the order they were submitted, so only one batch is pending here;
+    // the vertex storage is kept so the next batch does not reallocate.
+    void flush(sf::RenderTarget& target) {
+        if (m_batchTarget && m_batchTarget != &target)
+            return;
+        ProfileScope scope(m_profiler, "flush");
+        // At most one of the batches holds anything.
+        drawBatch(target, m_spanBatch);
+        drawBatch(target, m_batch);
+        m_batchTarget = nullptr;
+    }
+
+    // Moves whatever is batched, for any target, into the queue.
+    void flush(RenderQueue& queue, int layer = RenderQueue::PrimitiveLayer) {
+        queue.add(m_spanBatch, layer);
+        queue.add(m_batch, layer);
+        m_spanBatch.clear();
+        m_batch.clear();
+        m_batchTarget = nullptr;
+    }
+
+    void drawLineDefault(sf::RenderTarget& target,
+        const sf::Vector2f& a, const sf::Vector2f& b,
+        sf::Color color) {
+        ProfileScope scope(m_profiler, "drawLineDefault");
+        if (m_batchTarget)
+            flush(*m_batchTarget);
+
+        sf::Vertex verts[2] = {
+            sf::Vertex(a, color),
+            sf::Vertex(b, color)
+        };
+        target.draw(verts, 2, sf::Lines);
+        countDraw(2);
+    }
+
+    void drawLineIncremental(sf::RenderTarget& target,
+        const sf::Vector2f& a, const sf::Vector2f& b,
+        sf::Color color) {
+        ProfileScope scope(m_profiler, "drawLineIncremental");
+        rasterLine(a, b, targetPlot(target, color));
+        endPrimitive(target);
+    }
+
+    void drawLineIncremental(SoftwareFramebuffer& fb,
+        const sf::Vector2f& a, const sf::Vector2f& b,
+        sf::Color color) {
+        ProfileScope scope(m_profiler, "drawLineIncremental");
+        rasterLine(a, b, framebufferPlot(fb, color));
+    }
+
+    void drawLineIncremental(RenderQueue& queue,
+        const sf::Vector2f& a, const sf::Vector2f& b,
+        sf::Color color, int layer = RenderQueue::PrimitiveLayer) {
+        ProfileScope scope(m_profiler, "drawLineIncremental");
+        rasterLine(a, b, queuePlot(queue, color, layer));
+    }
+
+    void drawCircle(sf::RenderTarget& target,
+        const sf::Vector2f& center,
+        float R,
+        sf::Color color,
+        unsigned int steps = 64) {
+        ProfileScope scope(m_profiler, "drawCircle");
+        rasterCircle(center, R, steps, targetPlot(target, color));
+        endPrimitive(target);
+    }
+
+    void drawCircle(SoftwareFramebuffer& fb,
+        const sf::Vector2f& center,
+        float R,
+        sf::Color color,
+        unsigned int steps = 64) {
+        ProfileScope scope(m_profiler, "drawCircle");
+        rasterCircle(center, R, steps, framebufferPlot(fb, color));
+    }
+
+    void drawEllipse(sf::RenderTarget& target,
+        const sf::Vector2f& center,
+        float Rx, float Ry,
+        sf::Color color,
+        unsigned int steps = 90) {
+        ProfileScope scope(m_profiler, "drawEllipse");
+        rasterEllipse(center, Rx, Ry, steps, targetPlot(target, color));
+        endPrimitive(target);
+    }
+
+    void drawEllipse(SoftwareFramebuffer& fb,
+        const sf::Vector2f& center,
+        float Rx, float Ry,
+        sf::Color color,
+        unsigned int steps = 90) {
+        ProfileScope scope(m_profiler, "drawEllipse");
+        rasterEllipse(center, Rx, Ry, steps, framebufferPlot(fb, color));
+    }
+
+    void drawLineBresenham(sf::RenderTarget& target,
+        const sf::Vector2f& a, const sf::Vector2f& b,
+        sf::Color color) {
+        ProfileScope scope(m_profiler, "drawLineBresenham");
+        rasterLineBresenham(a, b, targetPlot(target, color));
+        endPrimitive(target);
+    }
+
+    void drawCircleMidpoint(sf::RenderTarget& target,
+        const sf::Vector2f& center,
+        float R,
+        sf::Color color) {
+        ProfileScope scope(m_profiler, "drawCircleMidpoint");
+        rasterCircleMidpoint(center, R, targetPlot(target, color));
+        endPrimitive(target);
+    }
+
+    void drawEllipseMidpoint(sf::RenderTarget& target,
+        const sf::Vector2f& center,
+        float Rx, float Ry,
+        sf::Color color) {
+        ProfileScope scope(m_profiler, "drawEllipseMidpoint");
+        rasterEllipseMidpoint(center, Rx, Ry, targetPlot(target, color));
+        endPrimitive(target);
+    }
+
+    static float cross(const sf::Vector2f& a,
+        const sf::Vector2f& b,
+        const sf::Vector2f& c) {
+        return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    }
+
+    static bool segmentsIntersect(const sf::Vector2f& a1, const sf::Vector2f& a2,
+        const sf::Vector2f& b1, const sf::Vector2f& b2) {
+        float d1 = cross(a1, a2, b1);
+        float d2 = cross(a1, a2, b2);
+        float d3 = cross(b1, b2, a1);
+        float d4 = cross(b1, b2, a2);
+
+        if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
+            ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) {
+            return true;
+        }
+        return false;
+    }
+
+    static bool isSimplePolygonBruteForce(const std::vector<sf::Vector2f>& pts) {
+        if (pts.size() < 3) return false;
+
+        std::size_t n = pts.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            sf::Vector2f a1 = pts[i];
+            sf::Vector2f a2 = pts[(i + 1) % n];
+            for (std::size_t j = i + 1; j < n; ++j) {
+                if (j == i) continue;
+                if ((j + 1) % n == i || (i + 1) % n == j) continue;
+
+                sf::Vector2f b1 = pts[j];
+                sf::Vector2f b2 = pts[(j + 1) % n];
+                if (segmentsIntersect(a1, a2, b1, b2)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Shamos-Hoey sweep: only edges that become neighbours in the sweep
+    // order are tested, which is enough to find a crossing if one exists.
+    // Scratch storage comes from the arena when one is given.
+    static bool isSimplePolygon(const std::vector<sf::Vector2f>& pts,
+        FrameArena* arena = nullptr) {
+        if (pts.size() < 3) return false;
+        if (pts.size() < 32) return isSimplePolygonBruteForce(pts);
+
+        const std::size_t n = pts.size();
+        auto leftOf = [](const sf::Vector2f& p, const sf::Vector2f& q) {
+            return p.x < q.x || (p.x == q.x && p.y < q.y);
+        };
+
+        ArenaAllocator<char> alloc(arena);
+        FrameVector<sf::Vector2f> lo(n, sf::Vector2f(), alloc), hi(n, sf::Vector2f(), alloc);
+        for (std::size_t i = 0; i < n; ++i) {
+            sf::Vector2f a = pts[i];
+            sf::Vector2f b = pts[(i + 1) % n];
+            if (leftOf(b, a)) std::swap(a, b);
+            lo[i] = a;
+            hi[i] = b;
+        }
+
+        struct Event {
+            float x;
+            float y;
+            bool insert;
+            std::size_t edge;
+        };
+        FrameVector<Event> events(alloc);
+        events.reserve(2 * n);
+        for (std::size_t i = 0; i < n; ++i) {
+            events.push_back({ lo[i].x, lo[i].y, true, i });
+            events.push_back({ hi[i].x, hi[i].y, false, i });
+        }
+        std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+            if (a.x != b.x) return a.x < b.x;
+            if (a.insert != b.insert) return a.insert;
+            return a.y < b.y;
+        });
+
+        float sweepX = 0.f;
+        auto yAt = [&](std::size_t e) {
+            float dx = hi[e].x - lo[e].x;
+            if (dx == 0.f) return lo[e].y;
+            float t = (sweepX - lo[e].x) / dx;
+            return lo[e].y + t * (hi[e].y - lo[e].y);
+        };
+        auto slope = [&](std::size_t e) {
+            float dx = hi[e].x - lo[e].x;
+            float dy = hi[e].y - lo[e].y;
+            return dx == 0.f ? (dy >= 0.f ? 1e30f : -1e30f) : dy / dx;
+        };
+        auto below = [&](std::size_t a, std::size_t b) {
+            if (a == b) return false;
+            float ya = yAt(a);
+            float yb = yAt(b);
+            if (ya != yb) return ya < yb;
+            float sa = slope(a);
+            float sb = slope(b);
+            if (sa != sb) return sa < sb;
+            return a < b;
+        };
+
+        auto adjacent = [n](std::size_t a, std::size_t b) {
+            return (a + 1) % n == b || (b + 1) % n == a;
+        };
+        auto crosses = [&](std::size_t a, std::size_t b) {
+            return !adjacent(a, b) &&
+                segmentsIntersect(pts[a], pts[(a + 1) % n],
+                    pts[b], pts[(b + 1) % n]);
+        };
+
+        struct Below {
+            const decltype(below)* f;
+            bool operator()(std::size_t a, std::size_t b) const { return (*f)(a, b); }
+        };
+        typedef std::set<std::size_t, Below, ArenaAllocator<std::size_t>> Status;
+        Status status(Below{ &below }, alloc);
+        FrameVector<Status::iterator> where(n, status.end(), alloc);
+
+        for (const Event& ev : events) {
+            sweepX = ev.x;
+            if (ev.insert) {
+                auto it = status.insert(ev.edge).first;
+                where[ev.edge] = it;
+                if (it != status.begin() && crosses(*std::prev(it), ev.edge))
+                    return false;
+                auto next = std::next(it);
+                if (next != status.end() && crosses(*next, ev.edge))
+                    return false;
+            }
+            else {
+                auto it = where[ev.edge];
+                auto next = std::next(it);
+                if (it != status.begin() && next != status.end() &&
+                    crosses(*std::prev(it), *next))
+                    return false;
+                status.erase(it);
+            }
+        }
+        return true;
+    }
+
+    // Validation results keyed by a hash of the vertex data, so a polygon
+    // that is drawn unchanged every frame is only swept once. Vertices are
+    // compared bitwise, like the hash reads them.
+    bool isSimplePolygonCached(const std::vector<sf::Vector2f>& pts) {
+        std::uint64_t key = hashVertices(pts);
+        auto it = m_simpleCache.find(key);
+        if (it != m_simpleCache.end() && it->second.points.size() == pts.size() &&
+            (pts.empty() || std::memcmp(it->second.points.data(), pts.data(),
+                pts.size() * sizeof(sf::Vector2f)) == 0))
+            return it->second.simple;
+
+        bool simple = isSimplePolygon(pts, m_frameArena);
+        if (it != m_simpleCache.end()) {
+            it->second.points.assign(pts.begin(), pts.end());
+            it->second.simple = simple;
+            return simple;
+        }
+        if (m_simpleCache.size() >= MaxSimpleCacheEntries)
+            m_simpleCache.clear();
+        m_simpleCache.emplace(key, SimpleEntry{ pts, simple });
+        return simple;
+    }
+
+    void clearPolygonCache() { m_simpleCache.clear(); }
+
+    // Circle and ellipse outlines and trig tables; see plotOutline().
+    void clearOutlineCache() {
+        m_outlineCache.clear();
+        m_circleArcs.clear();
+        m_ellipseArcs.clear();
+    }
+
+    std::size_t outlineCacheSize() const { return m_outlineCache.size(); }
+
+    bool drawPolygon(sf::RenderTarget& target,
+        const std::vector<sf::Vector2f>& pts,
+        sf::Color color) {
+        ProfileScope scope(m_profiler, "drawPolygon");
+        if (!isSimplePolygonCached(pts))
+            return false;
+
+        rasterPolygon(pts, targetPlot(target, color));
+        endPrimitive(target);
+        return true;
+    }
+
+    void fillPolygon(sf::RenderTarget& target,
+        const std::vector<sf::Vector2f>& pts,
+        sf::Color color,
+        FillRule rule = FillRule::EvenOdd) {
+        ProfileScope scope(m_profiler, "fillPolygon");
+        rasterPolygonFill(pts, rule, [&](int y, int x0, int x1) {
+            putSpan(target, y, x0, x1, color);
+        });
+        endPrimitive(target);
+    }
+
+    void fillPolygon(SoftwareFramebuffer& fb,
+        const std::vector<sf::Vector2f>& pts,
+        sf::Color color,
+        FillRule rule = FillRule::EvenOdd) {
+        ProfileScope scope(m_profiler, "fillPolygon");
+        sf::Uint32 packed = PixelView::pack(color);
+        rasterPolygonFill(pts, rule, [&](int y, int x0, int x1) {
+            fb.fillSpan(y, x0, x1, packed);
+        }, 0, (int)fb.size().y);
+    }
+
+    void rasterizePolygon(const std::vector<sf::Vector2f>& pts,
+        sf::Color color, sf::VertexArray& out) {
+        ProfileScope scope(m_profiler, "rasterizePolygon");
+        out.setPrimitiveType(sf::Points);
+        out.clear();
+        rasterPolygon(pts, [&out, color](int x, int y) {
+            out.append(sf::Vertex(sf::Vector2f((float)x, (float)y), color));
+        });
+    }
+
+    // Presents pixels rasterized earlier; pending batched pixels go first
+    // so draw order is preserved.
+    void drawRasterized(sf::RenderTarget& target, const sf::VertexArray& pixels) {
+        ProfileScope scope(m_profiler, "drawRasterized");
+        if (m_batchTarget)
+            flush(*m_batchTarget);
+        target.draw(pixels);
+        countDraw(pixels.getVertexCount());
+    }
+
+    void drawRasterized(RenderQueue& queue, const sf::VertexArray& pixels,
+        int layer = RenderQueue::PrimitiveLayer) {
+        queue.add(pixels, layer);
+    }
+
+    bool drawPolygon(SoftwareFramebuffer& fb,
+        const std::vector<sf::Vector2f>& pts,
+        sf::Color color) {
+        ProfileScope scope(m_profiler, "drawPolygon");
+        if (!isSimplePolygonCached(pts))
+            return false;
+
+        rasterPolygon(pts, framebufferPlot(fb, color));
+        return true;
+    }
+
+    void boundaryFill(sf::Image& img,
+        int x, int y,
+        const sf::Color& fillColor,
+        const sf::Color& boundaryColor) {
+        ProfileScope scope(m_profiler, "boundaryFill");
+        const sf::Uint32 fill = PixelView::pack(fillColor);
+        const sf::Uint32 boundary = PixelView::pack(boundaryColor);
+        scanlineFill(PixelView(img), x, y, fill, [=](sf::Uint32 c) {
+            return c != boundary && c != fill;
+        });
+    }
+
+    void floodFill(sf::Image& img,
+        int x, int y,
+        const sf::Color& fillColor) {
+        ProfileScope scope(m_profiler, "floodFill");
+        PixelView view(img);
+        if (!view.contains(x, y))
+            return;
+
+        const sf::Uint32 fill = PixelView::pack(fillColor);
+        const sf::Uint32 background = view.at(x, y);
+        if (background == fill)
+            return;
+
+        scanlineFill(view, x, y, fill, [=](sf::Uint32 c) {
+            return c == background;
+        });
+    }
+
+    void boundaryFillQueue(sf::Image& img,
+        int x, int y,
+        const sf::Color& fillColor,
+        const sf::Color& boundaryColor) {
+        ProfileScope scope(m_profiler, "boundaryFillQueue");
+        sf::Vector2u size = img.getSize();
+        if (x < 0 || y < 0 || (unsigned)x >= size.x || (unsigned)y >= size.y)
+            return;
+
+        sf::Color start = img.getPixel(x, y);
+        if (start == boundaryColor || start == fillColor)
+            return;
+
+        resetFillQueue(x, y);
+        sf::Vector2i p;
+        while (popFill(p)) {
+
+            if (p.x < 0 || p.y < 0 ||
+                (unsigned)p.x >= size.x || (unsigned)p.y >= size.y)
+                continue;
+
+            sf::Color c = img.getPixel(p.x, p.y);
+            if (c == boundaryColor || c == fillColor)
+                continue;
+
+            img.setPixel(p.x, p.y, fillColor);
+
+            pushFill(p.x + 1, p.y);
+            pushFill(p.x - 1, p.y);
+            pushFill(p.x, p.y + 1);
+            pushFill(p.x, p.y - 1);
+        }
+    }
+
+    void floodFillQueue(sf::Image& img,
+        int x, int y,
+        const sf::Color& fillColor) {
+        ProfileScope scope(m_profiler, "floodFillQueue");
+        sf::Vector2u size = img.getSize();
+        if (x < 0 || y < 0 || (unsigned)x >= size.x || (unsigned)y >= size.y)
+            return;
+
+        sf::Color backgroundColor = img.getPixel(x, y);
+        if (backgroundColor == fillColor)
+            return;
+
+        resetFillQueue(x, y);
+        sf::Vector2i p;
+        while (popFill(p)) {
+
+            if (p.x < 0 || p.y < 0 ||
+                (unsigned)p.x >= size.x || (unsigned)p.y >= size.y)
+                continue;
+
+            sf::Color c = img.getPixel(p.x, p.y);
+            if (c != backgroundColor || c == fillColor)
+                continue;
+
+            img.setPixel(p.x, p.y, fillColor);
+
+            pushFill(p.x + 1, p.y);
+            pushFill(p.x - 1, p.y);
+            pushFill(p.x, p.y + 1);
+            pushFill(p.x, p.y - 1);
+        }
+    }
+};
+
+inline void LineSegment::draw(sf::RenderTarget& target) {
+    if (m_renderer) {
+        m_renderer->drawLineIncremental(
+            target,
+            worldA(),
+            worldB(),
+            m_color
+        );
+    }
+    else {
+        sf::Vertex v[2] = {
+            sf::Vertex(worldA(), m_color),
+            sf::Vertex(worldB(), m_color)
+        };
+        target.draw(v, 2, sf::Lines);
+    }
+}
+
+inline bool LineSegment::record(RenderQueue& queue) {
+    if (m_renderer) {
+        m_renderer->drawLineIncremental(queue, worldA(), worldB(), m_color);
+        return true;
+    }
+    sf::Vertex v[2] = {
+        sf::Vertex(worldA(), m_color),
+        sf::Vertex(worldB(), m_color)
+    };
+    return queue.add(v, 2, sf::Lines, RenderQueue::PrimitiveLayer);
+}
+
+class PolygonShape : public ShapeObject {
+    std::vector<sf::Vector2f> m_points;
+    sf::Color m_color;
+    PrimitiveRenderer* m_renderer;
+
+    bool m_simple{ false };
+    mutable std::vector<sf::Vector2f> m_world;
+    mutable sf::Transform m_worldTransform;
+    mutable bool m_worldDirty{ true };
+    // Closed line strip for drawing without a renderer, reused each frame.
+    std::vector<sf::Vertex> m_strip;
+
+    bool m_rasterDirty{ true };
+    PrimitiveRenderer::RasterMode m_rasterMode{ PrimitiveRenderer::RasterMode::Float };
+    sf::VertexArray m_pixels{ sf::Points };
+
+    // Parents can move without notifying us, so the composed matrix is
+    // compared against the one the cached vertices were built with.
+    bool updateWorld() const {
+        sf::Transform t = worldTransform();
+        if (!m_worldDirty &&
+            std::equal(t.getMatrix(), t.getMatrix() + 16, m_worldTransform.getMatrix()))
+            return false;
+
+        m_world.resize(m_points.size());
+        for (std::size_t i = 0; i < m_points.size(); ++i)
+            m_world[i] = t.transformPoint(m_points[i]);
+        m_worldTransform = t;
+        m_worldDirty = false;
+        return true;
+    }
+
+    void rebuild() {
+        if (updateWorld())
+            m_rasterDirty = true;
+        if (!m_renderer)
+            return;
+        if (!m_rasterDirty && m_rasterMode == m_renderer->rasterMode())
+            return;
+
+        m_rasterMode = m_renderer->rasterMode();
+        m_pixels.clear();
+        if (m_simple)
+            m_renderer->rasterizePolygon(m_world, m_color, m_pixels);
+        m_rasterDirty = false;
+    }
+
+protected:
+    void onTransformChanged() override {
+        m_worldDirty = true;
+    }
+
+    sf::FloatRect localBounds() const override {
+        if (m_points.empty())
+            return sf::FloatRect();
+        float l = m_points[0].x, t = m_points[0].y, r = l, b = t;
+        for (const sf::Vector2f& p : m_points) {
+            l = std::min(l, p.x); r = std::max(r, p.x);
+            t = std::min(t, p.y); b = std::max(b, p.y);
+        }
+        return sf::FloatRect(l, t, r - l, b - t);
+    }
+
+public:
+    PolygonShape()
+        : m_color(sf::Color::White), m_renderer(nullptr) {
+    }
+
+    PolygonShape(PrimitiveRenderer& renderer,
+        const std::vector<sf::Vector2f>& points,
+        sf::Color color = sf::Color::White)
+        : m_color(color), m_renderer(&renderer) {
+        setVertices(points);
+    }
+
+    const std::vector<sf::Vector2f>& restVertices() const { return m_points; }
+
+    const std::vector<sf::Vector2f>& vertices() const {
+        updateWorld();
+        return m_world;
+    }
+
+    // Affine maps with a non-zero determinant cannot create or remove
+    // crossings, so simplicity is a property of the rest pose.
+    bool isSimple() const { return m_simple; }
+
+    void setVertices(const std::vector<sf::Vector2f>& points) {
+        m_points = points;
+        m_simple = PrimitiveRenderer::isSimplePolygon(m_points);
+        m_worldDirty = true;
+        refreshBounds();
+    }
+
+    void setRenderer(PrimitiveRenderer& r) {
+        m_renderer = &r;
+        m_rasterDirty = true;
+    }
+
+    void setColor(const sf::Color& c) {
+        if (c == m_color) return;
+        m_color = c;
+        m_rasterDirty = true;
+    }
+
+    void draw(sf::RenderTarget& target) override {
+        if (!m_simple)
+            return;
+
+        if (!m_renderer) {
+            updateWorld();
+            m_strip.clear();
+            for (const sf::Vector2f& p : m_world)
+                m_strip.emplace_back(p, m_color);
+            m_strip.emplace_back(m_world.front(), m_color);
+            target.draw(m_strip.data(), m_strip.size(), sf::LineStrip);
+            return;
+        }
+
+        rebuild();
+        m_renderer->drawRasterized(target, m_pixels);
+    }
+
+    bool record(RenderQueue& queue) override {
+        if (!m_simple)
+            return true;
+
+        if (!m_renderer) {
+            updateWorld();
+            for (std::size_t i = 0; i < m_world.size(); ++i) {
+                sf::Vertex v[2] = {
+                    sf::Vertex(m_world[i], m_color),
+                    sf::Vertex(m_world[(i + 1) % m_world.size()], m_color)
+                };
+                queue.add(v, 2, sf::Lines, RenderQueue::PrimitiveLayer);
+            }
+            return true;
+        }
+
+        rebuild();
+        m_renderer->drawRasterized(queue, m_pixels);
+        return true;
+    }
+
+    // Outline pixels in world space; empty while the polygon is not simple.
+    const sf::VertexArray& rasterized() {
+        rebuild();
+        return m_pixels;
+    }
+
+    void draw(SoftwareFramebuffer& fb) {
+        if (!m_simple || !m_renderer)
+            return;
+
+        rebuild();
+        sf::Uint32 packed = PixelView::pack(m_color);
+        for (std::size_t i = 0; i < m_pixels.getVertexCount(); ++i) {
+            const sf::Vector2f& p = m_pixels[i].position;
+            fb.setPixel((int)p.x, (int)p.y, packed);
+        }
+    }
+};
+
+class BitmapHandler {
+public:
+    static sf::Image create(unsigned width, unsigned height,
+        sf::Color color = sf::Color::Transparent) {
+        sf::Image img;
+        img.create(width, height, color);
+        return img;
+    }
+
+    static bool loadFromFile(const std::string& filename, sf::Image& img) {
+        return img.loadFromFile(filename);
+    }
+
+    static bool saveToFile(const std::string& filename, const sf::Image& img) {
+        return img.saveToFile(filename);
+    }
+
+    // Same arguments and result as sf::Image::copy, with the rows blended
+    // by PixelKernels. A zero-size srcRect means the whole source.
+    static void copy(const sf::Image& src, sf::Image& dst,
+        sf::Vector2u dstPos = { 0, 0 },
+        const sf::IntRect& srcRect = sf::IntRect(),
+        bool applyAlpha = true) {
+        sf::Vector2u srcSize = src.getSize();
+        sf::Vector2u dstSize = dst.getSize();
+        if (srcSize.x == 0 || srcSize.y == 0 || dstPos.x >= dstSize.x || dstPos.y >= dstSize.y)
+            return;
+
+        sf::IntRect r = srcRect;
+        if (r.width == 0 || r.height == 0)
+            r = sf::IntRect(0, 0, (int)srcSize.x, (int)srcSize.y);
+        r.left = std::max(r.left, 0);
+        r.top = std::max(r.top, 0);
+        int width = std::min({ r.width, (int)srcSize.x - r.left, (int)(dstSize.x - dstPos.x) });
+        int height = std::min({ r.height, (int)srcSize.y - r.top, (int)(dstSize.y - dstPos.y) });
+        if (width <= 0 || height <= 0)
+            return;
+
+        const sf::Uint32* srcPixels = reinterpret_cast<const sf::Uint32*>(src.getPixelsPtr());
+        PixelView out(dst);
+        for (int y = 0; y < height; ++y) {
+            const sf::Uint32* from = srcPixels + (std::size_t)(r.top + y) * srcSize.x + r.left;
+            sf::Uint32* to = out.row(dstPos.y + y) + dstPos.x;
+            if (applyAlpha)
+                PixelKernels::blend(from, to, (std::size_t)width);
+            else
+                std::memcpy(to, from, (std::size_t)width * 4);
+        }
+    }
+
+    // Gives pixels equal to key the alpha value, like createMaskFromColor.
+    static void colorKey(sf::Image& img, sf::Color key, sf::Uint8 alpha = 0) {
+        PixelView v(img);
+        PixelKernels::colorKey(v.data(), (std::size_t)v.width() * v.height(),
+            PixelView::pack(key), alpha);
+    }
+
+    // Scales colour by alpha, rounding, for premultiplied blending.
+    static void premultiply(sf::Image& img) {
+        PixelView v(img);
+        PixelKernels::premultiply(v.data(), (std::size_t)v.width() * v.height());
+    }
+
+    static PixelView view(sf::Image& img) {
+        return PixelView(img);
+    }
+
+    static void fillRect(sf::Image& img, const sf::IntRect& rect,
+        sf::Color color) {
+        PixelView(img).fillRect(rect, PixelView::pack(color));
+    }
+
+    static void drawFrame(sf::Image& img, const sf::IntRect& rect,
+        sf::Color color) {
+        PixelView v(img);
+        sf::Uint32 c = PixelView::pack(color);
+        v.fillRect({ rect.left, rect.top, rect.width, 1 }, c);
+        v.fillRect({ rect.left, rect.top + rect.height - 1, rect.width, 1 }, c);
+        v.fillRect({ rect.left, rect.top, 1, rect.height }, c);
+        v.fillRect({ rect.left + rect.width - 1, rect.top, 1, rect.height }, c);
+    }
+};
+
+// Packs animation frames (or any small images) into a single texture.
+// Frames are addressed by texture rect, so sprites sharing an atlas
+// animate by changing their rect and can be drawn with one texture bind.
+class TextureAtlas {
+    sf::Texture m_texture;
+    std::vector<sf::IntRect> m_frames;
+
+public:
+    TextureAtlas() = default;
+
+    TextureAtlas(const TextureAtlas&) = delete;
+    TextureAtlas& operator=(const TextureAtlas&) = delete;
+
+    // Shelf packing: tallest images first, rows filled left to right.
+    bool build(const std::vector<sf::Image>& images, unsigned padding = 1) {
+        sf::Image sheet;
+        return pack(images, sheet, m_frames, padding) && m_texture.loadFromImage(sheet);
+    }
+
+    // The CPU half of build(), for tools that store the packed sheet.
+    static bool pack(const std::vector<sf::Image>& images, sf::Image& sheet,
+        std::vector<sf::IntRect>& frames, unsigned padding = 1) {
+        frames.assign(images.size(), sf::IntRect());
+        if (images.empty())
+            return false;
+
+        const unsigned maxSize = sf::Texture::getMaximumSize();
+        std::size_t area = 0;
+        unsigned widest = 0;
+        for (const sf::Image& img : images) {
+            sf::Vector2u sz = img.getSize();
+            area += (std::size_t)(sz.x + padding) * (sz.y + padding);
+            widest = std::max(widest, sz.x + padding);
+        }
+
+        unsigned width = 1;
+        while ((std::size_t)width * width < area)
+            width *= 2;
+        width = std::min(std::max(width, widest), maxSize);
+
+        std::vector<std::size_t> order(images.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+            return images[a].getSize().y > images[b].getSize().y;
+        });
+
+        unsigned x = 0;
+        unsigned y = 0;
+        unsigned shelf = 0;
+        for (std::size_t i : order) {
+            sf::Vector2u sz = images[i].getSize();
+            if (x + sz.x > width) {
+                x = 0;
+                y += shelf;
+                shelf = 0;
+            }
+            frames[i] = sf::IntRect(x, y, sz.x, sz.y);
+            x += sz.x + padding;
+            shelf = std::max(shelf, sz.y + padding);
+        }
+
+        unsigned height = y + shelf;
+        if (height > maxSize)
+            return false;
+
+        sheet.create(width, height, sf::Color::Transparent);
+        for (std::size_t i = 0; i < images.size(); ++i)
+            BitmapHandler::copy(images[i], sheet,
+                { (unsigned)frames[i].left, (unsigned)frames[i].top }, sf::IntRect(), false);
+        return true;
+    }
+
+    // Already packed RGBA sheet, uploaded without an sf::Image in between.
+    bool load(const sf::Uint8* pixels, unsigned width, unsigned height,
+        const std::vector<sf::IntRect>& frames) {
+        m_frames = frames;
+        if (!m_texture.create(width, height))
+            return false;
+        m_texture.update(pixels);
+        return true;
+    }
+
+    // Uniform grid sprite sheet, frames read row by row.
+    bool loadSheet(const sf::Image& sheet, unsigned frameWidth, unsigned frameHeight) {
+        m_frames.clear();
+        if (frameWidth == 0 || frameHeight == 0 || !m_texture.loadFromImage(sheet))
+            return false;
+
+        sf::Vector2u sz = sheet.getSize();
+        for (unsigned y = 0; y + frameHeight <= sz.y; y += frameHeight)
+            for (unsigned x = 0; x + frameWidth <= sz.x; x += frameWidth)
+                m_frames.emplace_back(x, y, frameWidth, frameHeight);
+        return true;
+    }
+
+    const sf::Texture& texture() const { return m_texture; }
+    std::size_t frameCount() const { return m_frames.size(); }
+    const sf::IntRect& frame(std::size_t i) const { return m_frames[i]; }
+    const std::vector<sf::IntRect>& frames() const { return m_frames; }
+};
+
+typedef std::shared_ptr<const TextureAtlas> AtlasHandle;
+
+inline std::size_t resourceBytes(const sf::Image& img) {
+    return (std::size_t)img.getSize().x * img.getSize().y * 4;
+}
+
+inline std::size_t resourceBytes(const sf::Texture& tex) {
+    return (std::size_t)tex.getSize().x * tex.getSize().y * 4;
+}
+
+inline std::size_t resourceBytes(const TextureAtlas& atlas) {
+    return resourceBytes(atlas.texture());
+}
+
+// Reference-counted cache keyed by path or ID. Entries are declared with
+// a loader and only loaded on first get() or when their group is
+// preloaded. Once the byte budget is exceeded, the least recently used
+// entries that nobody else holds and that can be reloaded are dropped.
+template <typename Resource>
+class ResourceCache {
+public:
+    typedef std::function<bool(Resource&)> Loader;
+
+private:
+    struct Entry {
+        std::shared_ptr<Resource> resource;
+        Loader loader;
+        std::string group;
+        std::size_t bytes{ 0 };
+        std::uint64_t lastUse{ 0 };
+    };
+
+    std::unordered_map<std::string, Entry> m_entries;
+    std::size_t m_budget{ 0 };
+    std::size_t m_used{ 0 };
+    std::uint64_t m_clock{ 0 };
+
+    bool load(Entry& e) {
+        if (e.resource)
+            return true;
+        if (!e.loader)
+            return false;
+
+        auto res = std::make_shared<Resource>();
+        if (!e.loader(*res))
+            return false;
+        e.resource = res;
+        e.bytes = resourceBytes(*res);
+        m_used += e.bytes;
+        return true;
+    }
+
+    void release(Entry& e) {
+        m_used -= e.bytes;
+        e.bytes = 0;
+        e.resource.reset();
+    }
+
+public:
+    void declare(const std::string& id, Loader loader,
+        const std::string& group = std::string()) {
+        Entry& e = m_entries[id];
+        e.loader = std::move(loader);
+        e.group = group;
+    }
+
+    bool isDeclared(const std::string& id) const {
+        return m_entries.count(id) != 0;
+    }
+
+    bool isLoaded(const std::string& id) const {
+        auto it = m_entries.find(id);
+        return it != m_entries.end() && it->second.resource;
+    }
+
+    std::shared_ptr<Resource> insert(const std::string& id,
+        std::shared_ptr<Resource> res, const std::string& group = std::string()) {
+        Entry& e = m_entries[id];
+        if (e.resource)
+            release(e);
+        e.resource = std::move(res);
+        e.group = group;
+        e.bytes = e.resource ? resourceBytes(*e.resource) : 0;
+        e.lastUse = ++m_clock;
+        m_used += e.bytes;
+        // Held while evicting, so a reloadable entry the caller handed
+        // over is not dropped straight away.
+        std::shared_ptr<Resource> held = e.resource;
+        evict();
+        return held;
+    }
+
+    std::shared_ptr<Resource> get(const std::string& id) {
+        auto it = m_entries.find(id);
+        if (it == m_entries.end())
+            return nullptr;
+
+        Entry& e = it->second;
+        e.lastUse = ++m_clock;
+        if (!load(e))
+            return nullptr;
+
+        std::shared_ptr<Resource> res = e.resource;
+        evict();
+        return res;
+    }
+
+    std::size_t preload(const std::string& group) {
+        std::size_t loaded = 0;
+        for (auto& kv : m_entries) {
+            if (kv.second.group == group && load(kv.second)) {
+                kv.second.lastUse = ++m_clock;
+                ++loaded;
+            }
+        }
+        evict();
+        return loaded;
+    }
+
+    // Drops the cache's references; users still holding a resource keep it.
+    void unload(const std::string& group) {
+        for (auto& kv : m_entries)
+            if (kv.second.group == group && kv.second.resource)
+                release(kv.second);
+    }
+
+    void setBudget(std::size_t bytes) {
+        m_budget = bytes;
+        evict();
+    }
+
+    std::size_t budget() const { return m_budget; }
+    std::size_t usedBytes() const { return m_used; }
+
+    void evict() {
+        if (m_budget == 0)
+            return;
+
+        while (m_used > m_budget) {
+            Entry* victim = nullptr;
+            for (auto& kv : m_entries) {
+                Entry& e = kv.second;
+                if (!e.resource || !e.loader || e.resource.use_count() > 1)
+                    continue;
+                if (!victim || e.lastUse < victim->lastUse)
+                    victim = &e;
+            }
+            if (!victim)
+                return;
+            release(*victim);
+        }
+    }
+
+    void clear() {
+        m_entries.clear();
+        m_used = 0;
+    }
+};
+
+class ResourceManager {
+    ResourceCache<sf::Image>    m_images;
+    ResourceCache<sf::Texture>  m_textures;
+    ResourceCache<TextureAtlas> m_atlases;
+
+public:
+    ResourceCache<sf::Image>& images() { return m_images; }
+    ResourceCache<sf::Texture>& textures() { return m_textures; }
+    ResourceCache<TextureAtlas>& atlases() { return m_atlases; }
+
+    // Paths that were never declared are registered on first use with a
+    // file loader; textures reuse the cached decoded image.
+    std::shared_ptr<sf::Image> image(const std::string& path) {
+        if (!m_images.isDeclared(path)) {
+            m_images.declare(path, [path](sf::Image& img) {
+                return BitmapHandler::loadFromFile(path, img);
+            });
+        }
+        return m_images.get(path);
+    }
+
+    std::shared_ptr<sf::Texture> texture(const std::string& path) {
+        if (!m_textures.isDeclared(path)) {
+            m_textures.declare(path, [this, path](sf::Texture& tex) {
+                std::shared_ptr<sf::Image> img = image(path);
+                return img && tex.loadFromImage(*img);
+            });
+        }
+        return m_textures.get(path);
+    }
+
+    AtlasHandle atlas(const std::string& id) {
+        return m_atlases.get(id);
+    }
+
+    std::size_t preload(const std::string& group) {
+        return m_images.preload(group) + m_textures.preload(group) +
+            m_atlases.preload(group);
+    }
+
+    void unload(const std::string& group) {
+        m_atlases.unload(group);
+        m_textures.unload(group);
+        m_images.unload(group);
+    }
+
+    void setBudget(std::size_t imageBytes, std::size_t textureBytes) {
+        m_images.setBudget(imageBytes);
+        m_textures.setBudget(textureBytes);
+        m_atlases.setBudget(textureBytes);
+    }
+
+    std::size_t usedBytes() const {
+        return m_images.usedBytes() + m_textures.usedBytes() +
+            m_atlases.usedBytes();
+    }
+};
+
+// Decodes images on worker threads and hands them back through a bounded
+// queue; uploadPending() turns them into textures on the main thread
+// (where the GL context lives) under a time budget. Requested textures
+// show a placeholder until their upload has happened; they only enter the
+// resource cache once the upload has succeeded.
+class AsyncLoader {
+public:
+    typedef std::function<void(const std::shared_ptr<sf::Texture>&, bool)> ReadyCallback;
+
+private:
+    struct Job {
+        std::string path;
+        std::shared_ptr<sf::Image> image;
+        bool ok{ false };
+    };
+
+    // Requests for a path that is still loading share its texture and job.
+    struct Pending {
+        std::string group;
+        std::shared_ptr<sf::Texture> texture;
+        std::vector<ReadyCallback> callbacks;
+    };
+
+    ResourceManager& m_resources;
+    std::unordered_map<std::string, Pending> m_pending;
+    std::vector<std::thread> m_workers;
+    std::deque<Job> m_requests;
+    std::deque<Job> m_done;
+    std::size_t m_capacity;
+    std::size_t m_inFlight{ 0 };
+    bool m_stop{ false };
+    mutable std::mutex m_mutex;
+    std::condition_variable m_requestReady;
+    std::condition_variable m_doneSpace;
+    sf::Image m_placeholder;
+
+    void workerLoop() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_requestReady.wait(lock, [this] { return m_stop || !m_requests.empty(); });
+                if (m_stop)
+                    return;
+                job = std::move(m_requests.front());
+                m_requests.pop_front();
+            }
+
+            job.image = std::make_shared<sf::Image>();
+            job.ok = BitmapHandler::loadFromFile(job.path, *job.image);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_doneSpace.wait(lock, [this] { return m_stop || m_done.size() < m_capacity; });
+            if (m_stop)
+                return;
+            m_done.push_back(std::move(job));
+        }
+    }
+
+public:
+    explicit AsyncLoader(ResourceManager& resources,
+        unsigned threads = 0, std::size_t queueCapacity = 16)
+        : m_resources(resources), m_capacity(std::max<std::size_t>(queueCapacity, 1)) {
+        m_placeholder.create(16, 16, sf::Color(255, 0, 255));
+        PixelView v(m_placeholder);
+        for (unsigned y = 0; y < 16; ++y)
+            for (unsigned x = 0; x < 16; ++x)
+                if (((x / 4) + (y / 4)) % 2)
+                    v.at(x, y) = PixelView::pack(sf::Color::Black);
+
+        if (threads == 0) {
+            unsigned hw = std::thread::hardware_concurrency();
+            threads = hw > 1 ? hw - 1 : 1;
+        }
+        for (unsigned i = 0; i < threads; ++i)
+            m_workers.emplace_back(&AsyncLoader::workerLoop, this);
+    }
+
+    ~AsyncLoader() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_requestReady.notify_all();
+        m_doneSpace.notify_all();
+        for (std::thread& t : m_workers)
+            t.join();
+    }
+
+    AsyncLoader(const AsyncLoader&) = delete;
+    AsyncLoader& operator=(const AsyncLoader&) = delete;
+
+    const sf::Image& placeholder() const { return m_placeholder; }
+
+    // Main thread only. Returns the cached texture if it is already
+    // loaded; otherwise a placeholder texture that is filled in place once
+    // decoding finishes. A path that is already loading is not decoded
+    // again; its callback waits for the same upload.
+    std::shared_ptr<sf::Texture> loadTexture(const std::string& path,
+        ReadyCallback onReady = ReadyCallback(),
+        const std::string& group = std::string()) {
+        auto pending = m_pending.find(path);
+        if (pending != m_pending.end()) {
+            if (onReady)
+                pending->second.callbacks.push_back(std::move(onReady));
+            return pending->second.texture;
+        }
+
+        ResourceCache<sf::Texture>& textures = m_resources.textures();
+        if (textures.isLoaded(path)) {
+            std::shared_ptr<sf::Texture> tex = textures.get(path);
+            if (onReady)
+                onReady(tex, true);
+            return tex;
+        }
+
+        auto tex = std::make_shared<sf::Texture>();
+        tex->loadFromImage(m_placeholder);
+
+        Pending& p = m_pending[path];
+        p.group = group;
+        p.texture = tex;
+        if (onReady)
+            p.callbacks.push_back(std::move(onReady));
+
+        Job job;
+        job.path = path;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_requests.push_back(std::move(job));
+            ++m_inFlight;
+        }
+        m_requestReady.notify_one();
+        return tex;
+    }
+
+    // Main thread only. At least one finished image is uploaded per call
+    // so loading always makes progress.
+    unsigned uploadPending(sf::Time budget) {
+        sf::Clock clock;
+        unsigned uploaded = 0;
+        while (uploaded == 0 || clock.getElapsedTime() < budget) {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_done.empty())
+                    break;
+                job = std::move(m_done.front());
+                m_done.pop_front();
+                --m_inFlight;
+            }
+            m_doneSpace.notify_one();
+
+            // A failed path is forgotten so the next request retries it.
+            auto it = m_pending.find(job.path);
+            Pending p = std::move(it->second);
+            m_pending.erase(it);
+
+            bool ok = job.ok && p.texture->loadFromImage(*job.image);
+            if (ok) {
+                m_resources.images().insert(job.path, job.image, p.group);
+                m_resources.textures().insert(job.path, p.texture, p.group);
+            }
+            for (ReadyCallback& onReady : p.callbacks)
+                onReady(p.texture, ok);
+            ++uploaded;
+        }
+        return uploaded;
+    }
+
+    std::size_t pending() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_inFlight;
+    }
+};
+
+// Read-only file mapped copy-on-write: pages are read in on first touch
+// and written pages stay private to the process, so data mapped from a
+// file can be edited in place without changing the file.
+class MappedFile {
+    sf::Uint8* m_data{ nullptr };
+    std::size_t m_size{ 0 };
+#if defined(_WIN32)
+    HANDLE m_mapping{ nullptr };
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path) {
+        close();
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            m_mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!m_mapping)
+            return false;
+        m_data = static_cast<sf::Uint8*>(MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0));
+        if (!m_data) {
+            close();
+            return false;
+        }
+        m_size = (std::size_t)size.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+            p = mmap(nullptr, (std::size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        m_data = static_cast<sf::Uint8*>(p);
+        m_size = (std::size_t)st.st_size;
+        // Start read-ahead now rather than faulting page by page.
+        madvise(p, m_size, MADV_WILLNEED);
+#endif
+        return true;
+    }
+
+    void close() {
+#if defined(_WIN32)
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        m_mapping = nullptr;
+#else
+        if (m_data)
+            munmap(m_data, m_size);
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    bool isOpen() const { return m_data != nullptr; }
+    sf::Uint8* data() { return m_data; }
+    const sf::Uint8* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+};
+
+// Versioned binary scene: objects with transforms, polygon vertices,
+// sprite atlases and pre-decoded RGBA textures. Every record is a
+// little-endian POD at an aligned offset, so an opened file is used in
+// place: open() only checks that every offset and index is in bounds,
+// and nothing is decoded or copied until a texture is uploaded.
+// Sections store their record stride and the header its section count,
+// so fields and sections can be appended without changing Version; it
+// changes only when existing fields move.
+class SceneFile {
+public:
+    static constexpr std::uint32_t Magic = 0x53443253; // "S2DS"
+    static constexpr std::uint32_t Version = 1;
+    static constexpr std::uint32_t ByteOrder = 0x01020304;
+    // Pixel data starts on a cache line.
+    static constexpr std::size_t PixelAlignment = 64;
+    // Larger than any GPU texture; keeps width * height * 4 within 64 bits.
+    static constexpr std::uint32_t MaxTextureSize = 65535;
+
+    enum class Kind : std::uint32_t { Player, Polygon, Image };
+
+    enum SectionId { Objects, Vertices, Textures, Atlases, Frames, Strings, SectionCount };
+
+    struct Section {
+        std::uint64_t offset{ 0 };
+        std::uint32_t count{ 0 };
+        std::uint32_t stride{ 0 };
+    };
+
+    struct Header {
+        std::uint32_t magic{ Magic };
+        std::uint32_t version{ Version };
+        std::uint32_t byteOrder{ ByteOrder };
+        std::uint32_t sectionCount{ SectionCount };
+        std::uint64_t fileBytes{ 0 };
+        Section sections[SectionCount];
+    };
+
+    // Names are offsets into the string section; 0 is the empty string.
+    // texture and atlas are indices, or -1 for none.
+    struct Object {
+        Kind kind{ Kind::Image };
+        std::uint32_t name{ 0 };
+        float x{ 0.f };
+        float y{ 0.f };
+        float rotation{ 0.f };
+        float scaleX{ 1.f };
+        float scaleY{ 1.f };
+        std::uint32_t color{ 0xffffffff };
+        std::uint32_t firstVertex{ 0 };
+        std::uint32_t vertexCount{ 0 };
+        std::int32_t texture{ -1 };
+        std::int32_t atlas{ -1 };
+        float timePerFrame{ 0.f };
+    };
+
+    // RGBA8 rows, no padding.
+    struct Texture {
+        std::uint32_t width{ 0 };
+        std::uint32_t height{ 0 };
+        std::uint64_t offset{ 0 };
+    };
+
+    struct Atlas {
+        std::uint32_t name{ 0 };
+        std::int32_t texture{ -1 };
+        std::uint32_t firstFrame{ 0 };
+        std::uint32_t frameCount{ 0 };
+    };
+
+    struct Frame {
+        std::int32_t left, top, width, height;
+    };
+
+    static_assert(sizeof(Header) == 120 && sizeof(Object) == 52 &&
+        sizeof(Texture) == 16 && sizeof(Atlas) == 16 && sizeof(Frame) == 16,
+        "scene records must not change size");
+    static_assert(sizeof(sf::Vector2f) == 8, "vertices are read as sf::Vector2f");
+
+private:
+    MappedFile m_file;
+    sf::Uint8* m_data{ nullptr };
+    std::size_t m_size{ 0 };
+    Section m_sections[SectionCount];
+
+    template <typename T>
+    const T& record(SectionId id, std::size_t i) const {
+        const Section& s = m_sections[id];
+        return *reinterpret_cast<const T*>(m_data + s.offset + i * s.stride);
+    }
+
+    bool fits(std::uint64_t offset, std::uint64_t bytes) const {
+        return offset <= m_size && bytes <= m_size - offset;
+    }
+
+    bool attach(sf::Uint8* data, std::size_t size) {
+        m_data = data;
+        m_size = size;
+        if (validate())
+            return true;
+        close();
+        return false;
+    }
+
+    bool validate() {
+        if (m_size < sizeof(Header))
+            return false;
+        const Header& h = *reinterpret_cast<const Header*>(m_data);
+        if (h.magic != Magic || h.byteOrder != ByteOrder || h.version != Version ||
+            h.fileBytes != m_size || h.sectionCount < SectionCount ||
+            !fits(0, sizeof(Header) + (std::uint64_t)(h.sectionCount - SectionCount) * sizeof(Section)))
+            return false;
+
+        const std::uint32_t minStride[SectionCount] = {
+            sizeof(Object), sizeof(sf::Vector2f), sizeof(Texture), sizeof(Atlas), sizeof(Frame), 1
+        };
+        const std::uint32_t align[SectionCount] = {
+            alignof(Object), alignof(sf::Vector2f), alignof(Texture), alignof(Atlas), alignof(Frame), 1
+        };
+        for (int i = 0; i < SectionCount; ++i) {
+            const Section& s = h.sections[i];
+            if (s.stride < minStride[i] || s.stride % align[i] != 0 || s.offset % 8 != 0 ||
+                !fits(s.offset, (std::uint64_t)s.count * s.stride))
+                return false;
+            m_sections[i] = s;
+        }
+
+        const Section& strings = m_sections[Strings];
+        if (strings.count == 0 || m_data[strings.offset + strings.count - 1] != 0)
+            return false;
+        auto index = [](std::int32_t i, std::size_t count) {
+            return i >= -1 && i < (std::int64_t)count;
+        };
+
+        for (std::size_t i = 0; i < textureCount(); ++i) {
+            const Texture& t = texture(i);
+            if (t.width > MaxTextureSize || t.height > MaxTextureSize || t.offset % 4 != 0 ||
+                !fits(t.offset, (std::uint64_t)t.width * t.height * 4))
+                return false;
+        }
+        for (std::size_t i = 0; i < atlasCount(); ++i) {
+            const Atlas& a = atlas(i);
+            if (a.name >= strings.count || a.texture < 0 || !index(a.texture, textureCount()) ||
+                (std::uint64_t)a.firstFrame + a.frameCount > m_sections[Frames].count)
+                return false;
+        }
+        for (std::size_t i = 0; i < objectCount(); ++i) {
+            const Object& o = object(i);
+            if (o.name >= strings.count || !index(o.texture, textureCount()) ||
+                !index(o.atlas, atlasCount()) ||
+                (std::uint64_t)o.firstVertex + o.vertexCount > m_sections[Vertices].count)
+                return false;
+        }
+        return true;
+    }
+
+public:
+    SceneFile() = default;
+
+    SceneFile(const SceneFile&) = delete;
+    SceneFile& operator=(const SceneFile&) = delete;
+
+    bool open(const std::string& path) {
+        close();
+        return m_file.open(path) && attach(m_file.data(), m_file.size());
+    }
+
+    // In-memory scene, e.g. from SceneWriter::finish(); the bytes must
+    // stay alive and 8-byte aligned while the scene is open.
+    bool open(sf::Uint8* data, std::size_t size) {
+        close();
+        return attach(data, size);
+    }
+
+    void close() {
+        m_file.close();
+        m_data = nullptr;
+        m_size = 0;
+        for (Section& s : m_sections)
+            s = Section();
+    }
+
+    bool isOpen() const { return m_data != nullptr; }
+    std::size_t sizeBytes() const { return m_size; }
+
+    std::size_t objectCount() const { return m_sections[Objects].count; }
+    const Object& object(std::size_t i) const { return record<Object>(Objects, i); }
+
+    std::size_t textureCount() const { return m_sections[Textures].count; }
+    const Texture& texture(std::size_t i) const { return record<Texture>(Textures, i); }
+
+    std::size_t atlasCount() const { return m_sections[Atlases].count; }
+    const Atlas& atlas(std::size_t i) const { return record<Atlas>(Atlases, i); }
+
+    const char* name(std::uint32_t offset) const {
+        return reinterpret_cast<const char*>(m_data + m_sections[Strings].offset + offset);
+    }
+
+    int findAtlas(const std::string& atlasName) const {
+        for (std::size_t i = 0; i < atlasCount(); ++i)
+            if (atlasName == name(atlas(i).name))
+                return (int)i;
+        return -1;
+    }
+
+    static sf::Color color(const Object& o) { return PixelView::unpack(o.color); }
+
+    // Copied out: PolygonShape owns its points.
+    std::vector<sf::Vector2f> vertices(const Object& o) const {
+        std::vector<sf::Vector2f> pts(o.vertexCount);
+        for (std::uint32_t i = 0; i < o.vertexCount; ++i)
+            pts[i] = record<sf::Vector2f>(Vertices, o.firstVertex + i);
+        return pts;
+    }
+
+    // Writable view of the mapped pixels; edits never reach the file.
+    PixelView pixels(std::size_t i) {
+        const Texture& t = texture(i);
+        return PixelView(reinterpret_cast<sf::Uint32*>(m_data + t.offset), t.width, t.height);
+    }
+
+    bool loadTexture(std::size_t i, sf::Texture& tex) const {
+        const Texture& t = texture(i);
+        if (!tex.create(t.width, t.height))
+            return false;
+        tex.update(m_data + t.offset);
+        return true;
+    }
+
+    bool loadAtlas(std::size_t i, TextureAtlas& out) const {
+        const Atlas& a = atlas(i);
+        const Texture& t = texture((std::size_t)a.texture);
+        std::vector<sf::IntRect> frames(a.frameCount);
+        for (std::uint32_t f = 0; f < a.frameCount; ++f) {
+            const Frame& r = record<Frame>(Frames, a.firstFrame + f);
+            frames[f] = sf::IntRect(r.left, r.top, r.width, r.height);
+        }
+        return out.load(m_data + t.offset, t.width, t.height, frames);
+    }
+};
+
+// Builds SceneFile images. Records are collected as they are added and
+// laid out once by finish().
+class SceneWriter {
+    std::vector<SceneFile::Object> m_objects;
+    std::vector<sf::Vector2f> m_vertices;
+    std::vector<SceneFile::Texture> m_textures;
+    std::vector<sf::Image> m_images;
+    std::vector<SceneFile::Atlas> m_atlases;
+    std::vector<SceneFile::Frame> m_frames;
+    std::vector<char> m_strings{ '\0' };
+
+    static std::size_t alignUp(std::size_t v, std::size_t a) {
+        return (v + a - 1) / a * a;
+    }
+
+    template <typename T>
+    static void put(std::vector<sf::Uint8>& out, SceneFile::Section& s,
+        const std::vector<T>& records) {
+        s.offset = alignUp(out.size(), 16);
+        s.count = (std::uint32_t)records.size();
+        s.stride = sizeof(T);
+        out.resize(s.offset + records.size() * sizeof(T));
+        if (!records.empty())
+            std::memcpy(out.data() + s.offset, records.data(), records.size() * sizeof(T));
+    }
+
+public:
+    std::uint32_t addString(const std::string& s) {
+        std::uint32_t offset = (std::uint32_t)m_strings.size();
+        m_strings.insert(m_strings.end(), s.begin(), s.end());
+        m_strings.push_back('\0');
+        return offset;
+    }
+
+    // The image is copied, so it may be changed or destroyed afterwards.
+    std::int32_t addTexture(const sf::Image& img) {
+        m_images.push_back(img);
+        SceneFile::Texture t;
+        t.width = img.getSize().x;
+        t.height = img.getSize().y;
+        m_textures.push_back(t);
+        return (std::int32_t)m_textures.size() - 1;
+    }
+
+    std::int32_t addAtlas(const std::string& name, const std::vector<sf::Image>& images,
+        unsigned padding = 1) {
+        sf::Image sheet;
+        std::vector<sf::IntRect> frames;
+        if (!TextureAtlas::pack(images, sheet, frames, padding))
+            return -1;
+
+        SceneFile::Atlas a;
+        a.name = addString(name);
+        a.texture = addTexture(sheet);
+        a.firstFrame = (std::uint32_t)m_frames.size();
+        a.frameCount = (std::uint32_t)frames.size();
+        for (const sf::IntRect& r : frames)
+            m_frames.push_back({ r.left, r.top, r.width, r.height });
+        m_atlases.push_back(a);
+        return (std::int32_t)m_atlases.size() - 1;
+    }
+
+    // The returned record is valid until the next addObject().
+    SceneFile::Object& addObject(SceneFile::Kind kind, const std::string& name = std::string()) {
+        m_objects.emplace_back();
+        m_objects.back().kind = kind;
+        m_objects.back().name = name.empty() ? 0 : addString(name);
+        return m_objects.back();
+    }
+
+    void setVertices(SceneFile::Object& o, const std::vector<sf::Vector2f>& points) {
+        o.firstVertex = (std::uint32_t)m_vertices.size();
+        o.vertexCount = (std::uint32_t)points.size();
+        m_vertices.insert(m_vertices.end(), points.begin(), points.end());
+    }
+
+    std::vector<sf::Uint8> finish() const {
+        std::vector<sf::Uint8> out(sizeof(SceneFile::Header));
+        SceneFile::Header h;
+        put(out, h.sections[SceneFile::Objects], m_objects);
+        put(out, h.sections[SceneFile::Vertices], m_vertices);
+        put(out, h.sections[SceneFile::Textures], m_textures);
+        put(out, h.sections[SceneFile::Atlases], m_atlases);
+        put(out, h.sections[SceneFile::Frames], m_frames);
+        put(out, h.sections[SceneFile::Strings], m_strings);
+
+        for (std::size_t i = 0; i < m_images.size(); ++i) {
+            SceneFile::Texture t = m_textures[i];
+            std::size_t bytes = (std::size_t)t.width * t.height * 4;
+            t.offset = alignUp(out.size(), SceneFile::PixelAlignment);
+            out.resize(t.offset + bytes);
+            if (bytes)
+                std::memcpy(out.data() + t.offset, m_images[i].getPixelsPtr(), bytes);
+            std::memcpy(out.data() + h.sections[SceneFile::Textures].offset + i * sizeof(t),
+                &t, sizeof(t));
+        }
+
+        h.fileBytes = out.size();
+        std::memcpy(out.data(), &h, sizeof(h));
+        return out;
+    }
+
+    bool save(const std::string& path) const {
+        std::vector<sf::Uint8> bytes = finish();
+        std::FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f)
+            return false;
+        bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+        return std::fclose(f) == 0 && ok;
+    }
+};
+
+// Retained layer for content that rarely changes. It is rendered into an
+// off-screen texture only after invalidate() and otherwise composited with
+// a single sprite draw. Invalidation is whole-layer: SFML has no scissor
+// rect, and the static scene is cheap to redraw once.
+class StaticLayer {
+    sf::RenderTexture m_texture;
+    sf::Sprite m_sprite;
+    bool m_ready{ false };
+    bool m_dirty{ true };
+    unsigned m_rebuilds{ 0 };
+public:
+    bool create(unsigned width, unsigned height) {
+        m_ready = m_texture.create(width, height);
+        if (m_ready)
+            m_sprite.setTexture(m_texture.getTexture(), true);
+        m_dirty = true;
+        return m_ready;
+    }
+
+    bool ready() const { return m_ready; }
+    bool dirty() const { return m_dirty; }
+    unsigned rebuilds() const { return m_rebuilds; }
+
+    void invalidate() { m_dirty = true; }
+
+    // Calls redraw(sf::RenderTarget&) on the cleared texture if the layer
+    // is dirty; returns whether it did.
+    template <typename Redraw>
+    bool update(Redraw redraw, sf::Color clearColor = sf::Color::Transparent) {
+        if (!m_ready || !m_dirty)
+            return false;
+        m_texture.clear(clearColor);
+        redraw(static_cast<sf::RenderTarget&>(m_texture));
+        m_texture.display();
+        m_dirty = false;
+        ++m_rebuilds;
+        return true;
+    }
+
+    void draw(sf::RenderTarget& target) const {
+        target.draw(m_sprite);
+    }
+};
+
+// Collects textured quads and draws them with one call per texture and
+// layer. Lower layers are drawn first; within a layer, items are grouped
+// by texture and keep their submission order.
+class SpriteBatch {
+    struct Item {
+        const sf::Texture* texture;
+        int layer;
+        std::uint32_t order;
+        sf::Vertex quad[4];
+    };
+
+    std::vector<Item> m_items;
+    std::vector<std::uint32_t> m_sorted;
+    std::vector<sf::Vertex> m_vertices;
+    unsigned m_drawCalls{ 0 };
+
+public:
+    void clear() { m_items.clear(); }
+
+    std::size_t size() const { return m_items.size(); }
+    unsigned drawCalls() const { return m_drawCalls; }
+    std::size_t vertexCount() const { return m_items.size() * 6; }
+
+    void add(const sf::Sprite& sprite, int layer = 0) {
+        add(sprite.getTexture(), sprite.getTextureRect(),
+            sprite.getTransform(), sprite.getColor(), layer);
+    }
+
+    void add(const sf::Texture* texture, const sf::IntRect& r,
+        const sf::Transform& t, sf::Color c, int layer = 0) {
+        float w = (float)std::abs(r.width);
+        float h = (float)std::abs(r.height);
+        float left = (float)r.left;
+        float right = left + (float)r.width;
+        float top = (float)r.top;
+        float bottom = top + (float)r.height;
+
+        Item item;
+        item.texture = texture;
+        item.layer = layer;
+        item.order = (std::uint32_t)m_items.size();
+        item.quad[0] = sf::Vertex(t.transformPoint(0.f, 0.f), c, sf::Vector2f(left, top));
+        item.quad[1] = sf::Vertex(t.transformPoint(w, 0.f), c, sf::Vector2f(right, top));
+        item.quad[2] = sf::Vertex(t.transformPoint(w, h), c, sf::Vector2f(right, bottom));
+        item.quad[3] = sf::Vertex(t.transformPoint(0.f, h), c, sf::Vector2f(left, bottom));
+        m_items.push_back(item);
+    }
+
+    void draw(sf::RenderTarget& target) {
+        m_drawCalls = 0;
+        if (m_items.empty())
+            return;
+
+        m_sorted.resize(m_items.size());
+        for (std::size_t i = 0; i < m_sorted.size(); ++i)
+            m_sorted[i] = (std::uint32_t)i;
+        std::sort(m_sorted.begin(), m_sorted.end(), [this](std::uint32_t a, std::uint32_t b) {
+            const Item& ia = m_items[a];
+            const Item& ib = m_items[b];
+            if (ia.layer != ib.layer) return ia.layer < ib.layer;
+            if (ia.texture != ib.texture) return std::less<const sf::Texture*>()(ia.texture, ib.texture);
+            return ia.order < ib.order;
+        });
+
+        std::size_t i = 0;
+        while (i < m_sorted.size()) {
+            const Item& first = m_items[m_sorted[i]];
+            m_vertices.clear();
+            std::size_t j = i;
+            for (; j < m_sorted.size(); ++j) {
+                const Item& it = m_items[m_sorted[j]];
+                if (it.layer != first.layer || it.texture != first.texture)
+                    break;
+                const sf::Vertex* q = it.quad;
+                m_vertices.insert(m_vertices.end(), { q[0], q[1], q[2], q[0], q[2], q[3] });
+            }
+
+            sf::RenderStates states;
+            states.texture = first.texture;
+            target.draw(m_vertices.data(), m_vertices.size(), sf::Triangles, states);
+            ++m_drawCalls;
+            i = j;
+        }
+    }
+
+    // Hands the quads to the queue, which does the sorting instead.
+    void draw(RenderQueue& queue) const {
+        for (const Item& it : m_items)
+            queue.add(it.quad, 4, sf::TriangleFan, it.layer, it.texture);
+    }
+};
+
+class BitmapObject : public virtual SpatialObject, public virtual TransformableObject {
+protected:
+    sf::Sprite m_sprite;
+    int m_layer{ 0 };
+public:
+    virtual ~BitmapObject() = default;
+
+    sf::FloatRect bounds() const override { return m_sprite.getGlobalBounds(); }
+
+    const sf::Sprite& sprite() const { return m_sprite; }
+
+    void setLayer(int layer) { m_layer = layer; }
+    int layer() const { return m_layer; }
+
+    bool submit(SpriteBatch& batch) override {
+        batch.add(m_sprite, m_layer);
+        return true;
+    }
+
+    bool record(RenderQueue& queue) override {
+        return queue.add(m_sprite, m_layer);
+    }
+
+    void setTexture(const sf::Texture& tex) {
+        m_sprite.setTexture(tex);
+        refreshBounds();
+    }
+
+    void translate(float dx, float dy) override {
+        m_sprite.move(dx, dy);
+        refreshBounds();
+    }
+
+    void rotate(float angleDeg) override {
+        m_sprite.rotate(angleDeg);
+        refreshBounds();
+    }
+
+    void scale(float sx, float sy) override {
+        m_sprite.scale(sx, sy);
+        refreshBounds();
+    }
+
+    void draw(sf::RenderTarget& target) override {
+        target.draw(m_sprite);
+    }
+
+    sf::Vector2f position() const {
+        return m_sprite.getPosition();
+    }
+};
+
+// Shared time for lazily evaluated animation. Advancing it is one add;
+// each animation reading it works out its frame only when it is drawn.
+class AnimationClock {
+    double m_now{ 0.0 };
+public:
+    void advance(float dt) { m_now += dt; }
+    double now() const { return m_now; }
+    void reset() { m_now = 0.0; }
+
+    static std::size_t frameAt(double elapsed, float timePerFrame, std::size_t frameCount) {
+        if (frameCount == 0 || timePerFrame <= 0.f || elapsed <= 0.0)
+            return 0;
+        return (std::size_t)(elapsed / timePerFrame) % frameCount;
+    }
+};
+
+class AnimatedObject : public virtual UpdatableObject {
+public:
+    virtual ~AnimatedObject() = default;
+    virtual void animate(float dt) = 0;
+};
+
+// Only the animation time is kept up to date; the texture rect follows
+// it when the sprite is drawn, submitted or recorded, so objects that
+// are culled do no frame work. With a shared clock even animate() is a
+// no-op and the object needs no per-frame update at all.
+class SpriteObject : public BitmapObject, public AnimatedObject {
+protected:
+    AtlasHandle m_atlas;
+    std::vector<sf::IntRect> m_frames;
+    float  m_timePerFrame{ 0.15f };
+    const AnimationClock* m_clock{ nullptr };
+    double m_localTime{ 0.0 };
+    double m_start{ 0.0 };
+    double m_pausedAt{ 0.0 };
+    bool   m_paused{ false };
+    std::size_t m_currentFrame{ 0 };
+
+    double now() const { return m_clock ? m_clock->now() : m_localTime; }
+
+    void resolveFrame() {
+        if (m_frames.empty())
+            return;
+        std::size_t frame = AnimationClock::frameAt(
+            (m_paused ? m_pausedAt : now()) - m_start, m_timePerFrame, m_frames.size());
+        if (frame == m_currentFrame)
+            return;
+
+        sf::IntRect old = m_sprite.getTextureRect();
+        m_currentFrame = frame;
+        m_sprite.setTextureRect(m_frames[frame]);
+        if (old.width != m_frames[frame].width || old.height != m_frames[frame].height)
+            refreshBounds();
+    }
+
+public:
+    virtual ~SpriteObject() = default;
+
+    void setFrames(const AtlasHandle& atlas) {
+        if (atlas)
+            setFrames(atlas, atlas->frames());
+    }
+
+    void setFrames(const AtlasHandle& atlas, const std::vector<sf::IntRect>& frames) {
+        m_atlas = atlas;
+        m_frames = frames;
+        if (m_atlas && !m_frames.empty()) {
+            m_currentFrame = 0;
+            m_start = m_paused ? m_pausedAt : now();
+            m_sprite.setTexture(m_atlas->texture());
+            m_sprite.setTextureRect(m_frames[0]);
+            refreshBounds();
+        }
+    }
+
+    const AtlasHandle& atlas() const { return m_atlas; }
+
+    void setTimePerFrame(float t) { m_timePerFrame = t; }
+
+    // Follow a shared clock instead of the time passed to animate(); the
+    // animation restarts at the clock's current time.
+    void setClock(const AnimationClock* clock) {
+        m_clock = clock;
+        m_start = now();
+        if (m_paused)
+            m_pausedAt = m_start;
+    }
+
+    void pause() {
+        if (m_paused) return;
+        m_pausedAt = now();
+        m_paused = true;
+    }
+
+    void resume() {
+        if (!m_paused) return;
+        m_start += now() - m_pausedAt;
+        m_paused = false;
+    }
+
+    bool paused() const { return m_paused; }
+
+    std::size_t currentFrame() {
+        resolveFrame();
+        return m_currentFrame;
+    }
+
+    void animate(float dt) override {
+        if (!m_clock)
+            m_localTime += dt;
+    }
+
+    void update(float dt) override {
+        animate(dt);
+    }
+
+    bool submit(SpriteBatch& batch) override {
+        resolveFrame();
+        return BitmapObject::submit(batch);
+    }
+
+    bool record(RenderQueue& queue) override {
+        resolveFrame();
+        return BitmapObject::record(queue);
+    }
+
+    void draw(sf::RenderTarget& target) override {
+        resolveFrame();
+        BitmapObject::draw(target);
+    }
+};
+
+// Fixed worker pool for data-parallel loops. parallelFor splits [0, count)
+// into chunks, runs them on the workers and on the calling thread, and
+// returns when all chunks are done. Chunks are handed out dynamically by
+// default; in deterministic mode the chunk bounds and the chunk-to-thread
+// mapping depend only on count and thread count.
+class JobSystem {
+public:
+    typedef std::function<void(std::size_t, std::size_t)> RangeFn;
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_finished;
+    std::uint64_t m_generation{ 0 };
+    std::size_t m_active{ 0 };
+    bool m_stop{ false };
+
+    const RangeFn* m_task{ nullptr };
+    std::size_t m_count{ 0 };
+    std::size_t m_chunk{ 0 };
+    std::size_t m_numChunks{ 0 };
+    bool m_taskDeterministic{ false };
+    std::atomic<std::size_t> m_nextChunk{ 0 };
+    std::atomic<std::size_t> m_pending{ 0 };
+
+    bool m_singleThreaded{ false };
+    bool m_deterministic{ false };
+
+    void runChunk(std::size_t c) {
+        std::size_t begin = c * m_chunk;
+        std::size_t end = std::min(m_count, begin + m_chunk);
+        (*m_task)(begin, end);
+        if (m_pending.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished.notify_all();
+        }
+    }
+
+    void participate(std::size_t thread) {
+        if (m_taskDeterministic) {
+            std::size_t threads = m_workers.size() + 1;
+            for (std::size_t c = thread; c < m_numChunks; c += threads)
+                runChunk(c);
+            return;
+        }
+        std::size_t c;
+        while ((c = m_nextChunk.fetch_add(1)) < m_numChunks)
+            runChunk(c);
+    }
+
+    void workerLoop(std::size_t thread) {
+        std::uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop)
+                    return;
+                seen = m_generation;
+                ++m_active;
+            }
+            participate(thread);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_active == 0)
+                m_finished.notify_all();
+        }
+    }
+
+public:
+    explicit JobSystem(unsigned threads = 0) {
+        if (threads == 0) {
+            unsigned hw = std::thread::hardware_concurrency();
+            threads = hw > 1 ? hw - 1 : 0;
+        }
+        for (unsigned i = 0; i < threads; ++i)
+            m_workers.emplace_back(&JobSystem::workerLoop, this, (std::size_t)i + 1);
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& t : m_workers)
+            t.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    std::size_t threadCount() const { return m_singleThreaded ? 1 : m_workers.size() + 1; }
+
+    void setSingleThreaded(bool single) { m_singleThreaded = single; }
+    bool singleThreaded() const { return m_singleThreaded; }
+
+    void setDeterministic(bool deterministic) { m_deterministic = deterministic; }
+    bool deterministic() const { return m_deterministic; }
+
+    // Not reentrant: fn must not call parallelFor itself.
+    void parallelFor(std::size_t count, std::size_t grain, const RangeFn& fn) {
+        if (count == 0)
+            return;
+        grain = std::max<std::size_t>(grain, 1);
+        const std::size_t threads = m_workers.size() + 1;
+        if (m_singleThreaded || m_workers.empty() || count <= grain) {
+            fn(0, count);
+            return;
+        }
+
+        std::size_t chunk = m_deterministic
+            ? (count + threads - 1) / threads
+            : std::max(grain, count / (threads * 4));
+        chunk = std::max(chunk, grain);
+
+        {
+            // A worker that woke late for the previous loop may still be
+            // reading the task fields; let it drain before overwriting them.
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_finished.wait(lock, [this] { return m_active == 0; });
+            m_task = &fn;
+            m_count = count;
+            m_chunk = chunk;
+            m_numChunks = (count + chunk - 1) / chunk;
+            m_taskDeterministic = m_deterministic;
+            m_nextChunk.store(0);
+            m_pending.store(m_numChunks);
+            ++m_generation;
+        }
+        m_wake.notify_all();
+
+        participate(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [this] { return m_pending.load() == 0; });
+    }
+};
+
+// Splits software rendering over the framebuffer's tiles. Primitives are
+// recorded as they are drawn and binned into the tiles they may touch; on
+// flush() each tile is a task that rasterizes its primitives in order,
+// clipped to the tile, so tiles never write each other's pixels. The
+// clipped rasterizers give the same pixels as drawing into the framebuffer
+// directly. Seed fills read what was drawn before them, so they flush
+// first. Every thread then takes tiles with pending seeds from a shared
+// queue and fills that tile's pixels; spans that leave a tile become
+// seeds of the neighbour, which is queued unless it is already queued or
+// being filled. Like the renderer's batch, the bins belong to one
+// framebuffer; drawing into another flushes them.
+class TiledRasterizer {
+public:
+    static constexpr unsigned TileSize = SoftwareFramebuffer::TileSize;
+    // Seed fill tiles are square, halved from the maximum until an open
+    // region gives every thread FillTilesPerThread of them.
+    static constexpr unsigned MinFillTileSize = 64;
+    static constexpr unsigned MaxFillTileSize = 256;
+    static constexpr unsigned FillTilesPerThread = 16;
+
+private:
+    typedef PrimitiveRenderer::RasterMode RasterMode;
+    typedef PrimitiveRenderer::FillRule FillRule;
+    typedef PrimitiveRenderer::FillEdge FillEdge;
+
+    // One primitive as it was drawn. a is a line's start or a centre, b a
+    // line's end or the radii; fills own a range of m_edges.
+    struct Command {
+        enum Kind { Line, Circle, Ellipse, Fill };
+        int kind;
+        RasterMode mode;
+        FillRule rule;
+        sf::Uint32 color;
+        sf::Vector2f a;
+        sf::Vector2f b;
+        const std::vector<sf::Vector2f>* arc;
+        std::uint32_t first;
+        std::uint32_t count;
+        int yFirst;
+        int yLast;
+    };
+
+    struct Pixel {
+        int x;
+        int y;
+        sf::Uint32 color;
+    };
+
+    // A command, or a run [begin, end) of the bin's pre-rasterized pixels.
+    struct Item {
+        static constexpr std::uint32_t Pixels = 0xFFFFFFFFu;
+        std::uint32_t command;
+        std::uint32_t begin;
+        std::uint32_t end;
+    };
+
+    struct Bin {
+        std::vector<Item> items;
+        std::vector<Pixel> pixels;
+        std::vector<FillEdge> active;
+        bool wrote{ false };
+    };
+
+    // Row y, columns [x1, x2], growing in direction dy; dy 0 marks a
+    // single pixel seeded from a side, which grows both ways.
+    struct Seed {
+        int x1;
+        int x2;
+        int y;
+        int dy;
+    };
+
+    // seeds, queued and running belong to m_fillMutex; the rest to the
+    // thread filling the tile.
+    struct FillTile {
+        std::vector<Seed> seeds;
+        std::vector<Seed> work;
+        std::vector<Seed> stack;
+        std::vector<std::pair<std::size_t, Seed>> outbox;
+        bool queued{ false };
+        bool running{ false };
+        bool filled{ false };
+    };
+
+    PrimitiveRenderer& m_renderer;
+    JobSystem& m_jobs;
+
+    SoftwareFramebuffer* m_target{ nullptr };
+    unsigned m_width{ 0 };
+    unsigned m_height{ 0 };
+    unsigned m_tilesX{ 0 };
+    unsigned m_tilesY{ 0 };
+    std::vector<Bin> m_bins;
+    std::vector<std::size_t> m_binned;
+    std::vector<Command> m_commands;
+    std::vector<FillEdge> m_edges;
+    // Trig tables of pending Float circles and ellipses; the renderer's
+    // own may be evicted before the tiles read them.
+    std::unordered_map<unsigned int, std::vector<sf::Vector2f>> m_circleArcs;
+    std::unordered_map<unsigned int, std::vector<sf::Vector2f>> m_ellipseArcs;
+
+    unsigned m_fillWidth{ 0 };
+    unsigned m_fillHeight{ 0 };
+    unsigned m_fillTileSize{ 0 };
+    unsigned m_fillTilesX{ 0 };
+    std::vector<FillTile> m_fillTiles;
+    std::mutex m_fillMutex;
+    std::condition_variable m_fillWake;
+    std::vector<std::size_t> m_ready;
+    std::size_t m_fillRunning{ 0 };
+
+    void bind(SoftwareFramebuffer& fb) {
+        if (m_target && m_target != &fb)
+            flush(*m_target);
+        m_target = &fb;
+
+        sf::Vector2u size = fb.size();
+        if (size.x == m_width && size.y == m_height)
+            return;
+        m_width = size.x;
+        m_height = size.y;
+        m_tilesX = (m_width + TileSize - 1) / TileSize;
+        m_tilesY = (m_height + TileSize - 1) / TileSize;
+        m_bins.assign((std::size_t)m_tilesX * m_tilesY, Bin());
+        m_binned.clear();
+        m_commands.clear();
+        m_edges.clear();
+    }
+
+    const std::vector<sf::Vector2f>* arc(
+        std::unordered_map<unsigned int, std::vector<sf::Vector2f>>& cache,
+        unsigned int steps, float span) {
+        auto it = cache.find(steps);
+        if (it == cache.end())
+            it = cache.emplace(steps, PrimitiveRenderer::unitArc(steps, span)).first;
+        return &it->second;
+    }
+
+    Command& record(int kind, sf::Color color) {
+        Command c{};
+        c.kind = kind;
+        c.mode = m_renderer.m_rasterMode;
+        c.color = PixelView::pack(color);
+        m_commands.push_back(c);
+        return m_commands.back();
+    }
+
+    Bin& open(std::size_t index) {
+        Bin& bin = m_bins[index];
+        if (bin.items.empty())
+            m_binned.push_back(index);
+        return bin;
+    }
+
+    void binCommand(std::size_t index) {
+        open(index).items.push_back(Item{ (std::uint32_t)m_commands.size() - 1, 0, 0 });
+    }
+
+    // Tiles covering pixel columns [x0, x1] and rows [y0, y1], clamped to
+    // the framebuffer; false if nothing is left.
+    bool tileRange(int x0, int y0, int x1, int y1, sf::IntRect& tiles) const {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, (int)m_width - 1);
+        y1 = std::min(y1, (int)m_height - 1);
+        if (x0 > x1 || y0 > y1)
+            return false;
+        tiles.left = x0 / (int)TileSize;
+        tiles.top = y0 / (int)TileSize;
+        tiles.width = x1 / (int)TileSize - tiles.left + 1;
+        tiles.height = y1 / (int)TileSize - tiles.top + 1;
+        return true;
+    }
+
+    // Both rasterizers stay within a pixel of the segment between the
+    // rounded ends, so every tile column (or row, when steep) the segment
+    // crosses takes the tiles of its crossing plus a margin.
+    void binLine(sf::Vector2f a, sf::Vector2f b) {
+        const bool steep = std::fabs(b.y - a.y) > std::fabs(b.x - a.x);
+        if (steep) {
+            std::swap(a.x, a.y);
+            std::swap(b.x, b.y);
+        }
+        if (a.x > b.x)
+            std::swap(a, b);
+
+        const int majorSize = (int)(steep ? m_height : m_width);
+        const int minorSize = (int)(steep ? m_width : m_height);
+        const float slope = b.x > a.x ? (b.y - a.y) / (b.x - a.x) : 0.f;
+        const int m0 = std::max((int)std::floor(a.x - 1.f), 0);
+        const int m1 = std::min((int)std::ceil(b.x + 1.f), majorSize - 1);
+        if (m0 > m1)
+            return;
+
+        for (int t = m0 / (int)TileSize; t <= m1 / (int)TileSize; ++t) {
+            float s0 = std::max((float)(t * (int)TileSize), a.x);
+            float s1 = std::min((float)((t + 1) * (int)TileSize - 1), b.x);
+            float v0 = a.y + (s0 - a.x) * slope;
+            float v1 = a.y + (s1 - a.x) * slope;
+            int lo = std::max((int)std::floor(std::min(v0, v1) - 2.f), 0);
+            int hi = std::min((int)std::ceil(std::max(v0, v1) + 2.f), minorSize - 1);
+            for (int u = lo / (int)TileSize; u <= hi / (int)TileSize && lo <= hi; ++u)
+                binCommand(steep ? (std::size_t)t * m_tilesX + u : (std::size_t)u * m_tilesX + t);
+        }
+    }
+
+    // Tiles of the bounding box that can hold part of the outline: points
+    // stay within margin pixels of the ellipse with radii (rx, ry), so in
+    // units of the radii they lie within margin / min(rx, ry) of 1.
+    void binOutline(const sf::Vector2f& c, float rx, float ry) {
+        const float margin = 2.f;
+        sf::IntRect tiles;
+        if (!tileRange((int)std::floor(c.x - rx - margin), (int)std::floor(c.y - ry - margin),
+            (int)std::ceil(c.x + rx + margin), (int)std::ceil(c.y + ry + margin), tiles))
+            return;
+
+        const float slack = std::min(rx, ry) > margin ? margin / std::min(rx, ry) : -1.f;
+        for (int ty = tiles.top; ty < tiles.top + tiles.height; ++ty) {
+            for (int tx = tiles.left; tx < tiles.left + tiles.width; ++tx) {
+                if (slack > 0.f) {
+                    float x0 = (float)(tx * (int)TileSize) - c.x;
+                    float y0 = (float)(ty * (int)TileSize) - c.y;
+                    float x1 = x0 + (float)(TileSize - 1);
+                    float y1 = y0 + (float)(TileSize - 1);
+                    float nx = std::max(std::max(x0, -x1), 0.f) / rx;
+                    float ny = std::max(std::max(y0, -y1), 0.f) / ry;
+                    float fx = std::max(std::fabs(x0), std::fabs(x1)) / rx;
+                    float fy = std::max(std::fabs(y0), std::fabs(y1)) / ry;
+                    if (std::sqrt(nx * nx + ny * ny) > 1.f + slack ||
+                        std::sqrt(fx * fx + fy * fy) < 1.f - slack)
+                        continue;
+                }
+                binCommand((std::size_t)ty * m_tilesX + tx);
+            }
+        }
+    }
+
+    void recordLine(const sf::Vector2f& a, const sf::Vector2f& b, sf::Color color) {
+        Command& c = record(Command::Line, color);
+        c.a = a;
+        c.b = b;
+        binLine(a, b);
+    }
+
+    // Runs in a worker: the tile's commands in submission order.
+    void rasterTile(PixelView& view, std::size_t index) {
+        Bin& bin = m_bins[index];
+        const int left = (int)(index % m_tilesX) * (int)TileSize;
+        const int top = (int)(index / m_tilesX) * (int)TileSize;
+        const sf::IntRect clip(left, top,
+            std::min((int)TileSize, (int)m_width - left),
+            std::min((int)TileSize, (int)m_height - top));
+
+        bool wrote = false;
+        for (const Item& item : bin.items) {
+            if (item.command == Item::Pixels) {
+                for (std::uint32_t k = item.begin; k < item.end; ++k)
+                    view.at(bin.pixels[k].x, bin.pixels[k].y) = bin.pixels[k].color;
+                wrote = true;
+                continue;
+            }
+
+            const Command& c = m_commands[item.command];
+            const sf::Uint32 color = c.color;
+            auto plot = [&](int x, int y) {
+                view.at(x, y) = color;
+                wrote = true;
+            };
+            const bool integer = c.mode == RasterMode::Integer;
+            switch (c.kind) {
+            case Command::Line:
+                if (integer)
+                    PrimitiveRenderer::rasterLineBresenham(c.a, c.b, plot, &clip);
+                else
+                    PrimitiveRenderer::rasterLineDDA(c.a, c.b, plot, &clip);
+                break;
+            case Command::Circle:
+                if (integer)
+                    PrimitiveRenderer::rasterCircleMidpoint(c.a, c.b.x, plot, &clip);
+                else
+                    PrimitiveRenderer::rasterCircleSteps(c.a, c.b.x, *c.arc, plot, &clip);
+                break;
+            case Command::Ellipse:
+                if (integer)
+                    PrimitiveRenderer::rasterEllipseMidpoint(c.a, c.b.x, c.b.y, plot, &clip);
+                else
+                    PrimitiveRenderer::rasterEllipseSteps(c.a, c.b.x, c.b.y, *c.arc, plot, &clip);
+                break;
+            case Command::Fill:
+                PrimitiveRenderer::fillRows(m_edges.data() + c.first, c.count,
+                    std::max(c.yFirst, clip.top), std::min(c.yLast, clip.top + clip.height),
+                    c.rule, bin.active, [&](int y, int x0, int x1) {
+                        x0 = std::max(x0, clip.left);
+                        x1 = std::min(x1, clip.left + clip.width);
+                        if (x0 >= x1)
+                            return;
+                        sf::Uint32* row = view.row(y);
+                        std::fill(row + x0, row + x1, color);
+                        wrote = true;
+                    });
+                break;
+            }
+        }
+        bin.wrote = wrote;
+        bin.items.clear();
+        bin.pixels.clear();
+    }
+
+    static std::size_t fillTileCount(unsigned width, unsigned height, unsigned size) {
+        return (std::size_t)((width + size - 1) / size) * ((height + size - 1) / size);
+    }
+
+    void resizeFillGrid(unsigned width, unsigned height) {
+        const std::size_t wanted = m_jobs.threadCount() * FillTilesPerThread;
+        unsigned size = MaxFillTileSize;
+        while (size > MinFillTileSize && fillTileCount(width, height, size) < wanted)
+            size /= 2;
+        if (width == m_fillWidth && height == m_fillHeight && size == m_fillTileSize)
+            return;
+        m_fillWidth = width;
+        m_fillHeight = height;
+        m_fillTileSize = size;
+        m_fillTilesX = (width + size - 1) / size;
+        m_fillTiles.assign(fillTileCount(width, height, size), FillTile());
+    }
+
+    // Both under m_fillMutex. A tile that is being filled is queued again
+    // when it finishes, if seeds arrived meanwhile.
+    void queueFillTile(std::size_t index) {
+        FillTile& t = m_fillTiles[index];
+        if (t.queued || t.running)
+            return;
+        t.queued = true;
+        m_ready.push_back(index);
+    }
+
+    void postSeed(std::size_t index, const Seed& seed) {
+        m_fillTiles[index].seeds.push_back(seed);
+        queueFillTile(index);
+    }
+
+    // Span fill from PrimitiveRenderer::scanlineFill clipped to one tile.
+    // Only this tile's pixels are read or written; spans heading across an
+    // edge go to the outbox and continue in the neighbour.
+    template <typename Inside>
+    void fillTile(PixelView& view, std::size_t index, sf::Uint32 fill, Inside inside) {
+        FillTile& t = m_fillTiles[index];
+        const int w = (int)view.width();
+        const int h = (int)view.height();
+        const int size = (int)m_fillTileSize;
+        const int left = (int)(index % m_fillTilesX) * size;
+        const int top = (int)(index / m_fillTilesX) * size;
+        const int right = std::min(left + size, w);
+        const int bottom = std::min(top + size, h);
+
+        t.stack.clear();
+        for (const Seed& s : t.work) {
+            if (s.dy != 0) {
+                t.stack.push_back(s);
+                continue;
+            }
+            // Side seeds are not tested by the sender.
+            if (!inside(view.at(s.x1, s.y)))
+                continue;
+            t.stack.push_back({ s.x1, s.x1, s.y, 1 });
+            t.stack.push_back({ s.x1, s.x1, s.y - 1, -1 });
+        }
+        t.work.clear();
+
+        // A filled run [lx, x1) touching a side seeds the tile beyond it.
+        auto run = [&](int y, int lx, int x1) {
+            t.filled = true;
+            if (lx == left && left > 0)
+                t.outbox.push_back({ index - 1, Seed{ left - 1, left - 1, y, 0 } });
+            if (x1 == right && right < w)
+                t.outbox.push_back({ index + 1, Seed{ right, right, y, 0 } });
+        };
+
+        while (!t.stack.empty()) {
+            Seed s = t.stack.back();
+            t.stack.pop_back();
+
+            if (s.y < top || s.y >= bottom) {
+                if (s.y >= 0 && s.y < h)
+                    t.outbox.push_back({ s.y < top ? index - m_fillTilesX : index + m_fillTilesX, s });
+                continue;
+            }
+
+            sf::Uint32* row = view.row(s.y);
+            auto test = [&](int px) {
+                return px >= left && px < right && inside(row[px]);
+            };
+
+            int x1 = s.x1;
+            int lx = x1;
+            if (test(lx)) {
+                while (test(lx - 1)) {
+                    row[lx - 1] = fill;
+                    --lx;
+                }
+                if (lx < x1)
+                    t.stack.push_back({ lx, x1 - 1, s.y - s.dy, -s.dy });
+            }
+
+            while (x1 <= s.x2) {
+                while (test(x1)) {
+                    row[x1] = fill;
+                    ++x1;
+                }
+                if (x1 > lx) {
+                    run(s.y, lx, x1);
+                    t.stack.push_back({ lx, x1 - 1, s.y + s.dy, s.dy });
+                }
+                if (x1 - 1 > s.x2)
+                    t.stack.push_back({ s.x2 + 1, x1 - 1, s.y - s.dy, -s.dy });
+                ++x1;
+                while (x1 < s.x2 && !test(x1))
+                    ++x1;
+                lx = x1;
+            }
+        }
+    }
+
+    // One thread's share of a seed fill: takes queued tiles until none
+    // are queued or being filled.
+    template <typename Inside>
+    void drainFill(PixelView& view, sf::Uint32 fill, Inside& inside) {
+        std::unique_lock<std::mutex> lock(m_fillMutex);
+        for (;;) {
+            m_fillWake.wait(lock, [this] { return !m_ready.empty() || m_fillRunning == 0; });
+            if (m_ready.empty())
+                return;
+
+            std::size_t index = m_ready.back();
+            m_ready.pop_back();
+            FillTile& t = m_fillTiles[index];
+            t.queued = false;
+            t.running = true;
+            t.work.swap(t.seeds);
+            ++m_fillRunning;
+            lock.unlock();
+
+            fillTile(view, index, fill, inside);
+
+            lock.lock();
+            for (const std::pair<std::size_t, Seed>& seed : t.outbox)
+                postSeed(seed.first, seed.second);
+            t.outbox.clear();
+            t.running = false;
+            --m_fillRunning;
+            if (!t.seeds.empty())
+                queueFillTile(index);
+            if (!m_ready.empty() || m_fillRunning == 0)
+                m_fillWake.notify_all();
+        }
+    }
+
+    // Fills the 4-connected region of (x, y); the result is the same as
+    // the serial scanline fill, whatever order the tiles run in.
+    template <typename Inside>
+    void seedFill(PixelView view, int x, int y, sf::Uint32 fill, Inside inside) {
+        resizeFillGrid(view.width(), view.height());
+        std::size_t first = (std::size_t)(y / m_fillTileSize) * m_fillTilesX + x / m_fillTileSize;
+        m_ready.clear();
+        m_fillRunning = 0;
+        postSeed(first, Seed{ x, x, y, 0 });
+
+        m_jobs.parallelFor(m_jobs.threadCount(), 1, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i)
+                drainFill(view, fill, inside);
+        });
+    }
+
+    // Every framebuffer tile under a filled fill tile goes up on upload.
+    void markFilled(SoftwareFramebuffer& fb) {
+        for (std::size_t i = 0; i < m_fillTiles.size(); ++i) {
+            if (!m_fillTiles[i].filled)
+                continue;
+            unsigned left = (unsigned)(i % m_fillTilesX) * m_fillTileSize;
+            unsigned top = (unsigned)(i / m_fillTilesX) * m_fillTileSize;
+            unsigned right = std::min(left + m_fillTileSize, m_fillWidth);
+            unsigned bottom = std::min(top + m_fillTileSize, m_fillHeight);
+            for (unsigned ty = top / TileSize; ty <= (bottom - 1) / TileSize; ++ty)
+                for (unsigned tx = left / TileSize; tx <= (right - 1) / TileSize; ++tx)
+                    fb.markDirty(tx, ty);
+            m_fillTiles[i].filled = false;
+        }
+    }
+
+    void boundaryFill(PixelView view, int x, int y, sf::Uint32 fill, sf::Uint32 boundary) {
+        if (!view.contains(x, y))
+            return;
+        seedFill(view, x, y, fill, [=](sf::Uint32 c) {
+            return c != boundary && c != fill;
+        });
+    }
+
+    void floodFill(PixelView view, int x, int y, sf::Uint32 fill) {
+        if (!view.contains(x, y))
+            return;
+        sf::Uint32 background = view.at(x, y);
+        if (background == fill)
+            return;
+        seedFill(view, x, y, fill, [=](sf::Uint32 c) {
+            return c == background;
+        });
+    }
+
+public:
+    TiledRasterizer(PrimitiveRenderer& renderer, JobSystem& jobs)
+        : m_renderer(renderer), m_jobs(jobs) {
+    }
+
+    TiledRasterizer(const TiledRasterizer&) = delete;
+    TiledRasterizer& operator=(const TiledRasterizer&) = delete;
+
+    std::size_t pendingTiles() const { return m_binned.size(); }
+
+    void drawLineIncremental(SoftwareFramebuffer& fb,
+        const sf::Vector2f& a, const sf::Vector2f& b,
+        sf::Color color) {
+        ProfileScope scope(m_renderer.m_profiler, "tiledBin");
+        bind(fb);
+        recordLine(a, b, color);
+    }
+
+    void drawCircle(SoftwareFramebuffer& fb,
+        const sf::Vector2f& center,
+        float R,
+        sf::Color color,
+        unsigned int steps = 64) {
+        ProfileScope scope(m_renderer.m_profiler, "tiledBin");
+        bind(fb);
+        Command& c = record(Command::Circle, color);
+        c.a = center;
+        c.b = sf::Vector2f(R, R);
+        if (c.mode == RasterMode::Float)
+            c.arc = arc(m_circleArcs, steps, 3.14159265359f / 4.f);
+        binOutline(center, std::fabs(R), std::fabs(R));
+    }
+
+    void drawEllipse(SoftwareFramebuffer& fb,
+        const sf::Vector2f& center,
+        float Rx, float Ry,
+        sf::Color color,
+        unsigned int steps = 90) {
+        ProfileScope scope(m_renderer.m_profiler, "tiledBin");
+        bind(fb);
+        Command& c = record(Command::Ellipse, color);
+        c.a = center;
+        c.b = sf::Vector2f(Rx, Ry);
+        if (c.mode == RasterMode::Float)
+            c.arc = arc(m_ellipseArcs, steps, 3.14159265359f / 2.f);
+        binOutline(center, std::fabs(Rx), std::fabs(Ry));
+    }
+
+    bool drawPolygon(SoftwareFramebuffer& fb,
+        const std::vector<sf::Vector2f>& pts,
+        sf::Color color) {
+        ProfileScope scope(m_renderer.m_profiler, "tiledBin");
+        if (!m_renderer.isSimplePolygonCached(pts))
+            return false;
+        bind(fb);
+        std::size_t n = pts.size();
+        for (std::size_t i = 0; i < n; ++i)
+            recordLine(pts[i], pts[(i + 1) % n], color);
+        return true;
+    }
+
+    void fillPolygon(SoftwareFramebuffer& fb,
+        const std::vector<sf::Vector2f>& pts,
+        sf::Color color,
+        FillRule rule = FillRule::EvenOdd) {
+        ProfileScope scope(m_renderer.m_profiler, "tiledBin");
+        bind(fb);
+        std::size_t first = m_edges.size();
+        PrimitiveRenderer::appendFillEdges(pts, m_edges);
+        if (m_edges.size() == first)
+            return;
+
+        Command& c = record(Command::Fill, color);
+        c.rule = rule;
+        c.first = (std::uint32_t)first;
+        c.count = (std::uint32_t)(m_edges.size() - first);
+        c.yFirst = m_edges[first].yStart;
+        c.yLast = c.yFirst;
+        float minX = pts[0].x;
+        float maxX = pts[0].x;
+        for (std::size_t i = first; i < m_edges.size(); ++i)
+            c.yLast = std::max(c.yLast, m_edges[i].yEnd);
+        for (const sf::Vector2f& p : pts) {
+            minX = std::min(minX, p.x);
+            maxX = std::max(maxX, p.x);
+        }
+
+        sf::IntRect tiles;
+        if (!tileRange((int)std::floor(minX), c.yFirst, (int)std::ceil(maxX), c.yLast - 1, tiles))
+            return;
+        for (int ty = tiles.top; ty < tiles.top + tiles.height; ++ty)
+            for (int tx = tiles.left; tx < tiles.left + tiles.width; ++tx)
+                binCommand((std::size_t)ty * m_tilesX + tx);
+    }
+
+    // Pixels rasterized earlier, e.g. PolygonShape::rasterized().
+    void drawRasterized(SoftwareFramebuffer& fb, const sf::VertexArray& pixels) {
+        ProfileScope scope(m_renderer.m_profiler, "tiledBin");
+        bind(fb);
+        for (std::size_t i = 0; i < pixels.getVertexCount(); ++i) {
+            const sf::Vertex& v = pixels[i];
+            int x = (int)v.position.x;
+            int y = (int)v.position.y;
+            if (x < 0 || y < 0 || (unsigned)x >= m_width || (unsigned)y >= m_height)
+                continue;
+            Bin& bin = open((std::size_t)(y / TileSize) * m_tilesX + x / TileSize);
+            if (bin.items.empty() || bin.items.back().command != Item::Pixels)
+                bin.items.push_back(Item{ Item::Pixels, (std::uint32_t)bin.pixels.size(), 0 });
+            bin.pixels.push_back(Pixel{ x, y, PixelView::pack(v.color) });
+            bin.items.back().end = (std::uint32_t)bin.pixels.size();
+        }
+    }
+
+    void boundaryFill(SoftwareFramebuffer& fb,
+        int x, int y,
+        const sf::Color& fillColor,
+        const sf::Color& boundaryColor) {
+        flush(fb);
+        ProfileScope scope(m_renderer.m_profiler, "tiledBoundaryFill");
+        boundaryFill(fb.view(), x, y, PixelView::pack(fillColor), PixelView::pack(boundaryColor));
+        markFilled(fb);
+    }
+
+    void floodFill(SoftwareFramebuffer& fb,
+        int x, int y,
+        const sf::Color& fillColor) {
+        flush(fb);
+        ProfileScope scope(m_renderer.m_profiler, "tiledFloodFill");
+        floodFill(fb.view(), x, y, PixelView::pack(fillColor));
+        markFilled(fb);
+    }
+
+    void boundaryFill(sf::Image& img,
+        int x, int y,
+        const sf::Color& fillColor,
+        const sf::Color& boundaryColor) {
+        ProfileScope scope(m_renderer.m_profiler, "tiledBoundaryFill");
+        boundaryFill(PixelView(img), x, y, PixelView::pack(fillColor), PixelView::pack(boundaryColor));
+        for (FillTile& t : m_fillTiles)
+            t.filled = false;
+    }
+
+    void floodFill(sf::Image& img,
+        int x, int y,
+        const sf::Color& fillColor) {
+        ProfileScope scope(m_renderer.m_profiler, "tiledFloodFill");
+        floodFill(PixelView(img), x, y, PixelView::pack(fillColor));
+        for (FillTile& t : m_fillTiles)
+            t.filled = false;
+    }
+
+    // Rasterizes the recorded primitives of fb, one tile per task, and
+    // marks the tiles that were written for upload.
+    void flush(SoftwareFramebuffer& fb) {
+        bind(fb);
+        if (m_binned.empty()) {
+            m_commands.clear();
+            m_edges.clear();
+            return;
+        }
+        ProfileScope scope(m_renderer.m_profiler, "tiledFlush");
+
+        PixelView view = fb.view();
+        m_jobs.parallelFor(m_binned.size(), 1, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i)
+                rasterTile(view, m_binned[i]);
+        });
+
+        for (std::size_t index : m_binned) {
+            if (m_bins[index].wrote)
+                fb.markDirty((unsigned)(index % m_tilesX), (unsigned)(index / m_tilesX));
+        }
+        m_binned.clear();
+        m_commands.clear();
+        m_edges.clear();
+        if (m_circleArcs.size() > PrimitiveRenderer::MaxArcCacheEntries)
+            m_circleArcs.clear();
+        if (m_ellipseArcs.size() > PrimitiveRenderer::MaxArcCacheEntries)
+            m_ellipseArcs.clear();
+    }
+};
+
+typedef std::uint32_t Entity;
+
+// Sparse-set pool: components are stored densely in insertion order, with
+// an entity -> slot table for lookups. Removal swaps in the last element.
+template <typename T>
+class ComponentPool {
+    static constexpr std::uint32_t None = 0xFFFFFFFFu;
+
+    std::vector<T> m_data;
+    std::vector<Entity> m_owners;
+    std::vector<std::uint32_t> m_slot;
+
+public:
+    T& add(Entity e, const T& value = T()) {
+        if (e >= m_slot.size())
+            m_slot.resize((std::size_t)e + 1, None);
+        if (m_slot[e] != None)
+            return m_data[m_slot[e]] = value;
+
+        m_slot[e] = (std::uint32_t)m_data.size();
+        m_data.push_back(value);
+        m_owners.push_back(e);
+        return m_data.back();
+    }
+
+    void remove(Entity e) {
+        if (!has(e))
+            return;
+        std::uint32_t slot = m_slot[e];
+        std::uint32_t last = (std::uint32_t)m_data.size() - 1;
+        if (slot != last) {
+            m_data[slot] = std::move(m_data[last]);
+            m_owners[slot] = m_owners[last];
+            m_slot[m_owners[slot]] = slot;
+        }
+        m_data.pop_back();
+        m_owners.pop_back();
+        m_slot[e] = None;
+    }
+
+    bool has(Entity e) const {
+        return e < m_slot.size() && m_slot[e] != None;
+    }
+
+    T* find(Entity e) { return has(e) ? &m_data[m_slot[e]] : nullptr; }
+    const T* find(Entity e) const { return has(e) ? &m_data[m_slot[e]] : nullptr; }
+
+    std::size_t size() const { return m_data.size(); }
+    T& operator[](std::size_t i) { return m_data[i]; }
+    const T& operator[](std::size_t i) const { return m_data[i]; }
+    Entity entity(std::size_t i) const { return m_owners[i]; }
+};
+
+struct TransformComponent {
+    sf::Vector2f position{ 0.f, 0.f };
+    sf::Vector2f origin{ 0.f, 0.f };
+    sf::Vector2f scale{ 1.f, 1.f };
+    float rotation{ 0.f };
+
+    // State at the start of the current fixed step, for render interpolation.
+    sf::Vector2f previousPosition{ 0.f, 0.f };
+    sf::Vector2f previousScale{ 1.f, 1.f };
+    float previousRotation{ 0.f };
+
+    void storePrevious() {
+        previousPosition = position;
+        previousScale = scale;
+        previousRotation = rotation;
+    }
+
+    // Blend between the previous and current step; alpha 1 is the current state.
+    TransformComponent interpolated(float alpha) const {
+        TransformComponent t = *this;
+        t.position = previousPosition + (position - previousPosition) * alpha;
+        t.scale = previousScale + (scale - previousScale) * alpha;
+        float d = rotation - previousRotation;
+        if (d > 180.f) d -= 360.f;
+        if (d < -180.f) d += 360.f;
+        t.rotation = previousRotation + d * alpha;
+        return t;
+    }
+
+    // Same composition as sf::Transformable::getTransform.
+    sf::Transform matrix() const {
+        float angle = -rotation * 3.14159265359f / 180.f;
+        float cs = std::cos(angle);
+        float sn = std::sin(angle);
+        float sxc = scale.x * cs;
+        float syc = scale.y * cs;
+        float sxs = scale.x * sn;
+        float sys = scale.y * sn;
+        float tx = -origin.x * sxc - origin.y * sys + position.x;
+        float ty = origin.x * sxs - origin.y * syc + position.y;
+        return sf::Transform(sxc, sys, tx,
+            -sxs, syc, ty,
+            0.f, 0.f, 1.f);
+    }
+};
+
+struct VelocityComponent {
+    sf::Vector2f value{ 0.f, 0.f };
+};
+
+struct SpriteComponent {
+    const sf::Texture* texture{ nullptr };
+    sf::IntRect rect;
+    sf::Color color{ sf::Color::White };
+    int layer{ 0 };
+};
+
+// start is the registry clock time of frame 0; the current frame is
+// derived from it only when the sprite is submitted. While paused the
+// clock is read as pausedAt.
+struct AnimationComponent {
+    AtlasHandle atlas;
+    std::vector<sf::IntRect> frames;
+    float timePerFrame{ 0.15f };
+    double start{ 0.0 };
+    double pausedAt{ 0.0 };
+    bool paused{ false };
+
+    std::size_t frameAt(double now) const {
+        return AnimationClock::frameAt((paused ? pausedAt : now) - start,
+            timePerFrame, frames.size());
+    }
+};
+
+// Entity registry with one contiguous pool per component type. The
+// systems below walk a pool front to back instead of chasing objects.
+class Registry {
+    ComponentPool<TransformComponent> m_transforms;
+    ComponentPool<VelocityComponent>  m_velocities;
+    ComponentPool<SpriteComponent>    m_sprites;
+    ComponentPool<AnimationComponent> m_animations;
+
+    std::vector<std::uint8_t> m_alive;
+    std::vector<Entity> m_free;
+
+    // Animation is lazy: update() only advances the clock, and frames are
+    // picked from it at submission, for the sprites that are submitted.
+    AnimationClock m_clock;
+
+    // Batch is a SpriteBatch or a RenderQueue; a null view culls nothing.
+    template <typename Batch>
+    void submit(Entity e, const SpriteComponent& sprite, Batch& batch, float alpha,
+        const sf::FloatRect* view) const;
+
+public:
+    Entity create() {
+        Entity e;
+        if (!m_free.empty()) {
+            e = m_free.back();
+            m_free.pop_back();
+        }
+        else {
+            e = (Entity)m_alive.size();
+            m_alive.push_back(0);
+        }
+        m_alive[e] = 1;
+        return e;
+    }
+
+    void destroy(Entity e) {
+        if (!alive(e))
+            return;
+        m_transforms.remove(e);
+        m_velocities.remove(e);
+        m_sprites.remove(e);
+        m_animations.remove(e);
+        m_alive[e] = 0;
+        m_free.push_back(e);
+    }
+
+    bool alive(Entity e) const { return e < m_alive.size() && m_alive[e]; }
+
+    ComponentPool<TransformComponent>& transforms() { return m_transforms; }
+    ComponentPool<VelocityComponent>& velocities() { return m_velocities; }
+    ComponentPool<SpriteComponent>& sprites() { return m_sprites; }
+    ComponentPool<AnimationComponent>& animations() { return m_animations; }
+
+    // Range versions touch only the components of entities in the given
+    // pool slots, so disjoint ranges can run on different threads.
+    void updateMovement(float dt, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            TransformComponent* t = m_transforms.find(m_velocities.entity(i));
+            if (t)
+                t->position += m_velocities[i].value * dt;
+        }
+    }
+
+    void updateMovement(float dt) { updateMovement(dt, 0, m_velocities.size()); }
+    void updateAnimation(float dt) { m_clock.advance(dt); }
+
+    const AnimationClock& clock() const { return m_clock; }
+
+    // Texture rect of the sprite as it would be submitted now.
+    sf::IntRect frameRect(Entity e) const {
+        const SpriteComponent* s = m_sprites.find(e);
+        if (!s)
+            return sf::IntRect();
+        const AnimationComponent* a = m_animations.find(e);
+        return a && !a->frames.empty() ? a->frames[a->frameAt(m_clock.now())] : s->rect;
+    }
+
+    // Called at the start of each fixed step, before the systems run.
+    void storePrevious() {
+        for (std::size_t i = 0; i < m_transforms.size(); ++i)
+            m_transforms[i].storePrevious();
+    }
+
+    void update(float dt) {
+        updateMovement(dt);
+        updateAnimation(dt);
+    }
+
+    void update(float dt, JobSystem& jobs, std::size_t grain = 1024) {
+        jobs.parallelFor(m_velocities.size(), grain, [&](std::size_t b, std::size_t e) {
+            updateMovement(dt, b, e);
+        });
+        updateAnimation(dt);
+    }
+
+    // Movement of one entity, for adapters that are driven as individual
+    // GameObjects. Animation has nothing per entity to update.
+    void updateEntity(Entity e, float dt) {
+        TransformComponent* t = m_transforms.find(e);
+        VelocityComponent* v = m_velocities.find(e);
+        if (t && v)
+            t->position += v->value * dt;
+    }
+
+    template <typename Batch>
+    void submitSprites(Batch& batch, float alpha = 1.f) const {
+        for (std::size_t i = 0; i < m_sprites.size(); ++i)
+            submit(m_sprites.entity(i), m_sprites[i], batch, alpha, nullptr);
+    }
+
+    // Sprites whose bounds miss view are skipped before their frame is
+    // picked or their quad is built.
+    template <typename Batch>
+    void submitSprites(Batch& batch, const sf::FloatRect& view, float alpha = 1.f) const {
+        for (std::size_t i = 0; i < m_sprites.size(); ++i)
+            submit(m_sprites.entity(i), m_sprites[i], batch, alpha, &view);
+    }
+
+    template <typename Batch>
+    void submitSprite(Entity e, Batch& batch, float alpha = 1.f) const {
+        if (const SpriteComponent* s = m_sprites.find(e))
+            submit(e, *s, batch, alpha, nullptr);
+    }
+};
+
+template <typename Batch>
+inline void Registry::submit(Entity e, const SpriteComponent& sprite, Batch& batch, float alpha,
+    const sf::FloatRect* view) const {
+    if (!sprite.texture)
+        return;
+    const TransformComponent* t = m_transforms.find(e);
+
+    // Culled on a circle around the position that holds the sprite at any
+    // rotation, before the matrix is built. Frames of one animation share
+    // a size, so the stored rect bounds them all.
+    if (view) {
+        sf::Vector2f pos, origin, scale(1.f, 1.f);
+        if (t) {
+            pos = t->previousPosition + (t->position - t->previousPosition) * alpha;
+            scale = t->previousScale + (t->scale - t->previousScale) * alpha;
+            origin = t->origin;
+        }
+        float w = (float)std::abs(sprite.rect.width);
+        float h = (float)std::abs(sprite.rect.height);
+        float dx = std::max(std::abs(origin.x), std::abs(w - origin.x)) * std::abs(scale.x);
+        float dy = std::max(std::abs(origin.y), std::abs(h - origin.y)) * std::abs(scale.y);
+        float r = std::sqrt(dx * dx + dy * dy);
+        if (pos.x + r < view->left || pos.x - r > view->left + view->width ||
+            pos.y + r < view->top || pos.y - r > view->top + view->height)
+            return;
+    }
+
+    sf::Transform m = sf::Transform::Identity;
+    if (t)
+        m = alpha >= 1.f ? t->matrix() : t->interpolated(alpha).matrix();
+
+    const AnimationComponent* a = m_animations.find(e);
+    const sf::IntRect& rect = a && !a->frames.empty() ? a->frames[a->frameAt(m_clock.now())] : sprite.rect;
+    batch.add(sprite.texture, rect, m, sprite.color, sprite.layer);
+}
+
+// GameObject adapter over a registry entity. Without an explicit registry
+// the player owns a private one, so it still works as a standalone object.
+class Player : public GameObject, public virtual TransformableObject {
+    std::unique_ptr<Registry> m_ownRegistry;
+    Registry* m_registry;
+    Entity m_entity;
+    float m_speed{ 150.f };
+    int m_contacts{ 0 };
+
+    void init() {
+        m_entity = m_registry->create();
+        m_registry->transforms().add(m_entity);
+        m_registry->velocities().add(m_entity);
+        m_registry->sprites().add(m_entity);
+        m_registry->animations().add(m_entity);
+    }
+
+    TransformComponent& transform() { return *m_registry->transforms().find(m_entity); }
+
+public:
+    Player()
+        : m_ownRegistry(new Registry()), m_registry(m_ownRegistry.get()) {
+        init();
+    }
+
+    explicit Player(Registry& registry)
+        : m_registry(&registry) {
+        init();
+    }
+
+    ~Player() override {
+        m_registry->destroy(m_entity);
+    }
+
+    Player(const Player&) = delete;
+    Player& operator=(const Player&) = delete;
+
+    Entity entity() const { return m_entity; }
+
+    void setFrames(const AtlasHandle& atlas) {
+        if (atlas)
+            setFrames(atlas, atlas->frames());
+    }
+
+    void setFrames(const AtlasHandle& atlas, const std::vector<sf::IntRect>& frames) {
+        AnimationComponent& anim = *m_registry->animations().find(m_entity);
+        anim.atlas = atlas;
+        anim.frames = frames;
+        anim.start = m_registry->clock().now();
+        anim.paused = false;
+
+        SpriteComponent& sprite = *m_registry->sprites().find(m_entity);
+        sprite.texture = atlas ? &atlas->texture() : nullptr;
+        if (!frames.empty())
+            sprite.rect = frames[0];
+    }
+
+    void setTimePerFrame(float t) {
+        m_registry->animations().find(m_entity)->timePerFrame = t;
+    }
+
+    void setLayer(int layer) {
+        m_registry->sprites().find(m_entity)->layer = layer;
+    }
+
+    void setVelocity(const sf::Vector2f& v) {
+        m_registry->velocities().find(m_entity)->value = v;
+    }
+
+    sf::Vector2f position() const {
+        return m_registry->transforms().find(m_entity)->position;
+    }
+
+    // Corners of the current frame in world space, for colliders.
+    std::array<sf::Vector2f, 4> corners() const {
+        sf::IntRect r = m_registry->frameRect(m_entity);
+        sf::Transform m = m_registry->transforms().find(m_entity)->matrix();
+        float w = (float)std::abs(r.width);
+        float h = (float)std::abs(r.height);
+        return { { m.transformPoint(0.f, 0.f), m.transformPoint(w, 0.f),
+            m.transformPoint(w, h), m.transformPoint(0.f, h) } };
+    }
+
+    void onContact(const Contact& c) override {
+        m_contacts += c.phase == ContactPhase::Begin ? 1 : -1;
+        m_registry->sprites().find(m_entity)->color =
+            m_contacts > 0 ? sf::Color(255, 160, 160) : sf::Color::White;
+    }
+
+    void translate(float dx, float dy) override {
+        transform().position += sf::Vector2f(dx, dy);
+    }
+
+    void rotate(float angleDeg) override {
+        float& r = transform().rotation;
+        r = std::fmod(r + angleDeg, 360.f);
+        if (r < 0.f)
+            r += 360.f;
+    }
+
+    void scale(float sx, float sy) override {
+        transform().scale.x *= sx;
+        transform().scale.y *= sy;
+    }
+
+    // A shared registry's clock is advanced by Registry::update.
+    void update(float dt) override {
+        m_registry->updateEntity(m_entity, dt);
+        if (m_ownRegistry)
+            m_ownRegistry->updateAnimation(dt);
+    }
+
+    bool submit(SpriteBatch& batch) override {
+        m_registry->submitSprite(m_entity, batch);
+        return true;
+    }
+
+    bool record(RenderQueue& queue) override {
+        m_registry->submitSprite(m_entity, queue);
+        return true;
+    }
+
+    void draw(sf::RenderTarget& target) override {
+        const SpriteComponent& s = *m_registry->sprites().find(m_entity);
+        if (!s.texture)
+            return;
+        sf::Sprite sprite(*s.texture, m_registry->frameRect(m_entity));
+        sprite.setColor(s.color);
+        target.draw(sprite, sf::RenderStates(transform().matrix()));
+    }
+};
+
+// Colliders are world-space point chains: boxes and polygons are closed,
+// segments are open. Sweep-and-prune on x finds candidate pairs (the
+// order is re-sorted with insertion sort, which is near linear while
+// bodies move a little per step); the narrow phase tests edges with
+// PrimitiveRenderer::segmentsIntersect plus containment. detect() diffs
+// the touching pairs against the last call and sends Begin/End contacts.
+class CollisionWorld {
+public:
+    typedef int Body;
+
+private:
+    struct BodyData {
+        GameObject* owner{ nullptr };
+        std::vector<sf::Vector2f> points;
+        sf::FloatRect box;
+        bool closed{ false };
+        bool isBox{ false };
+        bool alive{ false };
+    };
+
+    std::vector<BodyData> m_bodies;
+    std::vector<Body> m_free;
+    std::vector<Body> m_order;
+    std::vector<std::uint64_t> m_pairs;
+    std::vector<std::uint64_t> m_previous;
+
+    static std::uint64_t pairKey(Body a, Body b) {
+        if (a > b) std::swap(a, b);
+        return ((std::uint64_t)(std::uint32_t)a << 32) | (std::uint32_t)b;
+    }
+
+    static sf::FloatRect boundsOf(const std::vector<sf::Vector2f>& pts) {
+        if (pts.empty())
+            return sf::FloatRect();
+        float l = pts[0].x, t = pts[0].y, r = l, b = t;
+        for (const sf::Vector2f& p : pts) {
+            l = std::min(l, p.x); r = std::max(r, p.x);
+            t = std::min(t, p.y); b = std::max(b, p.y);
+        }
+        return sf::FloatRect(l, t, r - l, b - t);
+    }
+
+    static bool boxesOverlap(const sf::FloatRect& a, const sf::FloatRect& b) {
+        return a.left <= b.left + b.width && b.left <= a.left + a.width &&
+            a.top <= b.top + b.height && b.top <= a.top + a.height;
+    }
+
+    void deliver(Body self, Body other, ContactPhase phase) {
+        GameObject* owner = m_bodies[self].owner;
+        if (owner)
+            owner->onContact(Contact{ phase, self, other, m_bodies[other].owner });
+    }
+
+    // Copies into the existing point storage, so reshaping a body every
+    // frame does not allocate once its capacity is reached.
+    void shape(Body id, const sf::Vector2f* pts, std::size_t count, bool closed, bool isBox) {
+        BodyData& b = m_bodies[id];
+        b.points.assign(pts, pts + count);
+        b.closed = closed;
+        b.isBox = isBox;
+        b.box = boundsOf(b.points);
+    }
+
+public:
+    static bool onSegment(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& p) {
+        return std::min(a.x, b.x) <= p.x && p.x <= std::max(a.x, b.x) &&
+            std::min(a.y, b.y) <= p.y && p.y <= std::max(a.y, b.y);
+    }
+
+    // segmentsIntersect only reports proper crossings; touching and
+    // collinear overlap count as contact here.
+    static bool segmentsTouch(const sf::Vector2f& a1, const sf::Vector2f& a2,
+        const sf::Vector2f& b1, const sf::Vector2f& b2) {
+        if (PrimitiveRenderer::segmentsIntersect(a1, a2, b1, b2))
+            return true;
+        return (PrimitiveRenderer::cross(a1, a2, b1) == 0.f && onSegment(a1, a2, b1)) ||
+            (PrimitiveRenderer::cross(a1, a2, b2) == 0.f && onSegment(a1, a2, b2)) ||
+            (PrimitiveRenderer::cross(b1, b2, a1) == 0.f && onSegment(b1, b2, a1)) ||
+            (PrimitiveRenderer::cross(b1, b2, a2) == 0.f && onSegment(b1, b2, a2));
+    }
+
+    static bool pointInPolygon(const std::vector<sf::Vector2f>& poly, const sf::Vector2f& p) {
+        bool inside = false;
+        for (std::size_t i = 0, j = poly.size() - 1; i < poly.size(); j = i++) {
+            const sf::Vector2f& a = poly[i];
+            const sf::Vector2f& b = poly[j];
+            if ((a.y > p.y) != (b.y > p.y) &&
+                p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+                inside = !inside;
+        }
+        return inside;
+    }
+
+    // Chains touch if any pair of edges touches or one lies inside the
+    // other, which only a closed chain can contain.
+    static bool chainsTouch(const std::vector<sf::Vector2f>& a, bool closedA,
+        const std::vector<sf::Vector2f>& b, bool closedB) {
+        if (a.empty() || b.empty())
+            return false;
+        std::size_t ea = closedA ? a.size() : a.size() - 1;
+        std::size_t eb = closedB ? b.size() : b.size() - 1;
+        for (std::size_t i = 0; i < ea; ++i) {
+            const sf::Vector2f& a1 = a[i];
+            const sf::Vector2f& a2 = a[(i + 1) % a.size()];
+            for (std::size_t j = 0; j < eb; ++j)
+                if (segmentsTouch(a1, a2, b[j], b[(j + 1) % b.size()]))
+                    return true;
+        }
+        if (closedA && a.size() >= 3 && pointInPolygon(a, b[0]))
+            return true;
+        if (closedB && b.size() >= 3 && pointInPolygon(b, a[0]))
+            return true;
+        return false;
+    }
+
+    Body add(GameObject* owner = nullptr) {
+        Body id;
+        if (!m_free.empty()) {
+            id = m_free.back();
+            m_free.pop_back();
+        }
+        else {
+            id = (Body)m_bodies.size();
+            m_bodies.emplace_back();
+        }
+        m_bodies[id].owner = owner;
+        m_bodies[id].alive = true;
+        m_order.push_back(id);
+        return id;
+    }
+
+    // Ends any contacts of the body right away, on both sides, so its slot
+    // can be reused before the next detect(). An owner being destroyed
+    // should remove its body before it stops handling onContact().
+    void remove(Body id) {
+        if (!valid(id))
+            return;
+        auto keep = m_pairs.begin();
+        for (std::uint64_t key : m_pairs) {
+            Body a = (Body)(key >> 32);
+            Body b = (Body)(key & 0xffffffffu);
+            if (a != id && b != id) {
+                *keep++ = key;
+                continue;
+            }
+            deliver(a, b, ContactPhase::End);
+            deliver(b, a, ContactPhase::End);
+        }
+        m_pairs.erase(keep, m_pairs.end());
+        m_order.erase(std::find(m_order.begin(), m_order.end(), id));
+        m_bodies[id] = BodyData();
+        m_free.push_back(id);
+    }
+
+    bool valid(Body id) const {
+        return id >= 0 && (std::size_t)id < m_bodies.size() && m_bodies[id].alive;
+    }
+
+    void setBox(Body id, const sf::FloatRect& r) {
+        const sf::Vector2f pts[] = { { r.left, r.top }, { r.left + r.width, r.top },
+            { r.left + r.width, r.top + r.height }, { r.left, r.top + r.height } };
+        shape(id, pts, 4, true, true);
+    }
+
+    void setSegment(Body id, const sf::Vector2f& a, const sf::Vector2f& b) {
+        const sf::Vector2f pts[] = { a, b };
+        shape(id, pts, 2, false, false);
+    }
+
+    void setPolygon(Body id, const sf::Vector2f* pts, std::size_t count) {
+        shape(id, pts, count, true, false);
+    }
+
+    void setPolygon(Body id, const std::vector<sf::Vector2f>& pts) {
+        setPolygon(id, pts.data(), pts.size());
+    }
+
+    template <std::size_t N>
+    void setPolygon(Body id, const std::array<sf::Vector2f, N>& pts) {
+        setPolygon(id, pts.data(), N);
+    }
+
+    const sf::FloatRect& bounds(Body id) const { return m_bodies[id].box; }
+    const std::vector<std::uint64_t>& pairs() const { return m_pairs; }
+
+    bool touching(Body a, Body b) const {
+        return std::binary_search(m_pairs.begin(), m_pairs.end(), pairKey(a, b));
+    }
+
+    void detect() {
+        for (std::size_t i = 1; i < m_order.size(); ++i) {
+            Body id = m_order[i];
+            float left = m_bodies[id].box.left;
+            std::size_t j = i;
+            for (; j > 0 && m_bodies[m_order[j - 1]].box.left > left; --j)
+                m_order[j] = m_order[j - 1];
+            m_order[j] = id;
+        }
+
+        m_previous.swap(m_pairs);
+        m_pairs.clear();
+        for (std::size_t i = 0; i < m_order.size(); ++i) {
+            const BodyData& a = m_bodies[m_order[i]];
+            float right = a.box.left + a.box.width;
+            for (std::size_t j = i + 1; j < m_order.size(); ++j) {
+                const BodyData& b = m_bodies[m_order[j]];
+                if (b.box.left > right)
+                    break;
+                if (!boxesOverlap(a.box, b.box))
+                    continue;
+                if ((a.isBox && b.isBox) || chainsTouch(a.points, a.closed, b.points, b.closed))
+                    m_pairs.push_back(pairKey(m_order[i], m_order[j]));
+            }
+        }
+        std::sort(m_pairs.begin(), m_pairs.end());
+
+        std::size_t i = 0, j = 0;
+        while (i < m_pairs.size() || j < m_previous.size()) {
+            bool takeNew = j == m_previous.size() ||
+                (i < m_pairs.size() && m_pairs[i] < m_previous[j]);
+            bool takeOld = i == m_pairs.size() ||
+                (j < m_previous.size() && m_previous[j] < m_pairs[i]);
+            if (!takeNew && !takeOld) {
+                ++i; ++j;
+                continue;
+            }
+            std::uint64_t key = takeNew ? m_pairs[i++] : m_previous[j++];
+            ContactPhase phase = takeNew ? ContactPhase::Begin : ContactPhase::End;
+            Body a = (Body)(key >> 32);
+            Body b = (Body)(key & 0xffffffffu);
+            deliver(a, b, phase);
+            deliver(b, a, phase);
+        }
+    }
+};
+
+// Named actions driven by key events instead of polling. handleEvent()
+// is fed from pollEvent and updates cached bits that down(), pressed()
+// and released() read. An action may have several keys and is down while
+// any of them is held; key repeat is ignored. pressed() and released()
+// report edges since the last beginFrame(). Rebinding a held key takes
+// effect when it is released, so the held count stays balanced.
+class InputMap {
+public:
+    typedef std::size_t Action;
+    static constexpr std::size_t MaxActions = 64;
+
+private:
+    static constexpr std::size_t KeyCount = sf::Keyboard::KeyCount;
+
+    std::array<std::uint64_t, KeyCount> m_bindings{};
+    // Bindings a held key takes on release, valid where m_deferred is set.
+    std::array<std::uint64_t, KeyCount> m_nextBindings{};
+    std::array<bool, KeyCount> m_deferred{};
+    std::array<bool, KeyCount> m_keys{};
+    std::array<std::uint8_t, MaxActions> m_held{};
+    std::uint64_t m_down{ 0 };
+    std::uint64_t m_pressed{ 0 };
+    std::uint64_t m_released{ 0 };
+
+    static bool valid(sf::Keyboard::Key key) {
+        return key >= 0 && (std::size_t)key < KeyCount;
+    }
+
+    void setKey(sf::Keyboard::Key key, bool down) {
+        if (m_keys[key] == down)
+            return;
+        m_keys[key] = down;
+        std::uint64_t actions = m_bindings[key];
+        for (Action a = 0; actions; ++a, actions >>= 1) {
+            if (!(actions & 1))
+                continue;
+            std::uint64_t bit = std::uint64_t(1) << a;
+            if (down && m_held[a]++ == 0) {
+                m_down |= bit;
+                m_pressed |= bit;
+            }
+            else if (!down && --m_held[a] == 0) {
+                m_down &= ~bit;
+                m_released |= bit;
+            }
+        }
+        if (!down && m_deferred[key]) {
+            m_bindings[key] = m_nextBindings[key];
+            m_deferred[key] = false;
+        }
+    }
+
+    void rebind(sf::Keyboard::Key key, std::uint64_t bindings) {
+        if (!m_keys[key]) {
+            m_bindings[key] = bindings;
+            return;
+        }
+        m_nextBindings[key] = bindings;
+        m_deferred[key] = true;
+    }
+
+    std::uint64_t bindings(sf::Keyboard::Key key) const {
+        return m_deferred[key] ? m_nextBindings[key] : m_bindings[key];
+    }
+
+public:
+    // Changes to a held key are stored and applied when it is released.
+    void bind(Action action, sf::Keyboard::Key key) {
+        if (action < MaxActions && valid(key))
+            rebind(key, bindings(key) | std::uint64_t(1) << action);
+    }
+
+    void unbind(Action action, sf::Keyboard::Key key) {
+        if (action < MaxActions && valid(key))
+            rebind(key, bindings(key) & ~(std::uint64_t(1) << action));
+    }
+
+    bool isBound(Action action, sf::Keyboard::Key key) const {
+        return action < MaxActions && valid(key) && (bindings(key) >> action & 1);
+    }
+
+    void beginFrame() {
+        m_pressed = 0;
+        m_released = 0;
+    }
+
+    // Returns whether the event was a key event for a bound key.
+    bool handleEvent(const sf::Event& event) {
+        if (event.type == sf::Event::LostFocus) {
+            releaseAll();
+            return false;
+        }
+        if (event.type != sf::Event::KeyPressed && event.type != sf::Event::KeyReleased)
+            return false;
+        if (!valid(event.key.code))
+            return false;
+        setKey(event.key.code, event.type == sf::Event::KeyPressed);
+        return m_bindings[event.key.code] != 0;
+    }
+
+    // Key-up events are not delivered while the window is unfocused.
+    void releaseAll() {
+        for (std::size_t k = 0; k < KeyCount; ++k)
+            if (m_keys[k])
+                setKey((sf::Keyboard::Key)k, false);
+    }
+
+    bool down(Action a) const { return a < MaxActions && (m_down >> a & 1); }
+    bool pressed(Action a) const { return a < MaxActions && (m_pressed >> a & 1); }
+    bool released(Action a) const { return a < MaxActions && (m_released >> a & 1); }
+
+    // -1, 0 or 1 from a pair of opposing actions.
+    float axis(Action negative, Action positive) const {
+        return (down(positive) ? 1.f : 0.f) - (down(negative) ? 1.f : 0.f);
+    }
+};
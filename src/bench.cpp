@@ -0,0 +1,510 @@
+#include "Silnik2D.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
+// Headless benchmarks for the raster, fill and update paths. Each result
+// is one line of output (JSON by default, CSV with --csv) so runs can be
+// diffed or fed to a tracking script. Timings are CPU-side: for the
+// render_texture backend they include batching and draw submission, not
+// GPU completion.
+//
+//   bench [--filter <substring>] [--min-time <ms>] [--csv] [--no-gpu]
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+
+// Results of pure calls are stored here so they are not optimized away.
+volatile bool g_sink;
+
+struct Options {
+    std::string filter;
+    double minTimeMs{ 200.0 };
+    bool csv{ false };
+    bool gpu{ true };
+};
+
+struct Result {
+    std::string name;
+    std::string backend;
+    long long param;
+    std::size_t iterations;
+    double meanNs;
+    double minNs;
+    double medianNs;
+};
+
+class Bench {
+    Options m_options;
+    bool m_headerDone{ false };
+
+    void report(const Result& r) {
+        if (m_options.csv) {
+            if (!m_headerDone)
+                std::printf("name,backend,param,iterations,mean_ns,min_ns,median_ns\n");
+            std::printf("%s,%s,%lld,%u,%.1f,%.1f,%.1f\n", r.name.c_str(), r.backend.c_str(),
+                r.param, (unsigned)r.iterations, r.meanNs, r.minNs, r.medianNs);
+        }
+        else {
+            std::printf("{\"name\":\"%s\",\"backend\":\"%s\",\"param\":%lld,\"iterations\":%u,"
+                "\"mean_ns\":%.1f,\"min_ns\":%.1f,\"median_ns\":%.1f}\n",
+                r.name.c_str(), r.backend.c_str(), r.param, (unsigned)r.iterations,
+                r.meanNs, r.minNs, r.medianNs);
+        }
+        m_headerDone = true;
+        std::fflush(stdout);
+    }
+
+public:
+    explicit Bench(const Options& options) : m_options(options) {}
+
+    bool gpu() const { return m_options.gpu; }
+
+    // setup() runs before every iteration and is not timed.
+    template <typename Setup, typename Op>
+    void run(const std::string& name, const std::string& backend, long long param,
+        Setup setup, Op op) {
+        std::string id = name + "/" + backend + "/" + std::to_string(param);
+        if (!m_options.filter.empty() && id.find(m_options.filter) == std::string::npos)
+            return;
+
+        setup();
+        op();
+
+        std::vector<double> samples;
+        double total = 0.0;
+        while (samples.size() < 5 || total < m_options.minTimeMs * 1e6) {
+            setup();
+            BenchClock::time_point t0 = BenchClock::now();
+            op();
+            BenchClock::time_point t1 = BenchClock::now();
+            double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+            samples.push_back(ns);
+            total += ns;
+        }
+
+        Result r;
+        r.name = name;
+        r.backend = backend;
+        r.param = param;
+        r.iterations = samples.size();
+        r.meanNs = total / samples.size();
+        r.minNs = *std::min_element(samples.begin(), samples.end());
+        std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+        r.medianNs = samples[samples.size() / 2];
+        report(r);
+    }
+
+    template <typename Op>
+    void run(const std::string& name, const std::string& backend, long long param, Op op) {
+        run(name, backend, param, [] {}, op);
+    }
+};
+
+// Star-shaped polygon: sorted angles around a centre never self-intersect.
+std::vector<sf::Vector2f> makePolygon(std::size_t n, sf::Vector2f c, float r, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> radius(r * 0.5f, r);
+    std::vector<sf::Vector2f> pts;
+    for (std::size_t i = 0; i < n; ++i) {
+        float a = 6.2831853f * (float)i / (float)n;
+        float d = radius(rng);
+        pts.emplace_back(c.x + d * std::cos(a), c.y + d * std::sin(a));
+    }
+    return pts;
+}
+
+// White image with a one-pixel black frame; the inside is the region.
+sf::Image makeFillImage(unsigned size) {
+    sf::Image img = BitmapHandler::create(size, size, sf::Color::White);
+    BitmapHandler::drawFrame(img, sf::IntRect(0, 0, (int)size, (int)size), sf::Color::Black);
+    return img;
+}
+
+// Raster is the PrimitiveRenderer or a TiledRasterizer.
+template <typename Raster, typename Target>
+void benchOutlines(Bench& bench, Raster& renderer, Target& target,
+    const std::string& backend, const std::function<void()>& finish) {
+    const sf::Color color = sf::Color::Black;
+
+    bench.run("drawLineIncremental", backend, 500, [&] {
+        renderer.drawLineIncremental(target, { 10.f, 10.f }, { 510.f, 260.f }, color);
+        finish();
+    });
+
+    for (int radius : { 10, 60, 200 })
+        bench.run("drawCircle", backend, radius, [&] {
+            renderer.drawCircle(target, { 300.f, 300.f }, (float)radius, color);
+            finish();
+        });
+
+    for (int rx : { 20, 80, 250 })
+        bench.run("drawEllipse", backend, rx, [&] {
+            renderer.drawEllipse(target, { 300.f, 300.f }, (float)rx, rx * 0.5f, color);
+            finish();
+        });
+}
+
+template <typename Raster, typename Target>
+void benchPrimitives(Bench& bench, Raster& renderer, Target& target,
+    const std::string& backend, std::function<void()> finish) {
+    const sf::Color color = sf::Color::Black;
+    benchOutlines(bench, renderer, target, backend, finish);
+
+    for (std::size_t n : { 4u, 16u, 64u, 256u, 1024u }) {
+        std::vector<sf::Vector2f> poly = makePolygon(n, { 300.f, 300.f }, 250.f, (unsigned)n);
+        bench.run("drawPolygon", backend, (long long)n, [&] {
+            renderer.drawPolygon(target, poly, color);
+            finish();
+        });
+        bench.run("fillPolygon", backend, (long long)n, [&] {
+            renderer.fillPolygon(target, poly, color);
+            finish();
+        });
+    }
+}
+
+// The outlines in both raster modes, and on a render target in every
+// pixel mode; the primitive backends above run Integer and are batched
+// per frame on the GPU. Leaves the renderer as it found it.
+void benchRasterModes(Bench& bench, PrimitiveRenderer& renderer, SoftwareFramebuffer& framebuffer) {
+    typedef PrimitiveRenderer::RasterMode RasterMode;
+    typedef PrimitiveRenderer::PixelMode PixelMode;
+    const std::pair<RasterMode, const char*> rasterModes[] = {
+        { RasterMode::Integer, "integer" }, { RasterMode::Float, "float" }
+    };
+    const std::pair<PixelMode, const char*> pixelModes[] = {
+        { PixelMode::Immediate, "immediate" },
+        { PixelMode::BatchedPerPrimitive, "per_primitive" },
+        { PixelMode::BatchedPerFrame, "per_frame" }
+    };
+    const RasterMode initialRaster = renderer.rasterMode();
+    const PixelMode initialPixel = renderer.pixelMode();
+
+    sf::RenderTexture texture;
+    const bool gpu = bench.gpu() && texture.create(1024, 1024);
+    for (const auto& raster : rasterModes) {
+        renderer.setRasterMode(raster.first);
+        const std::string suffix = std::string("_") + raster.second;
+        benchOutlines(bench, renderer, framebuffer, "software" + suffix, [] {});
+        if (!gpu)
+            continue;
+        for (const auto& pixel : pixelModes) {
+            renderer.setPixelMode(pixel.first);
+            benchOutlines(bench, renderer, texture, "render_texture" + suffix + "_" + pixel.second, [&] {
+                renderer.flush(texture);
+            });
+        }
+    }
+
+    renderer.setRasterMode(initialRaster);
+    renderer.setPixelMode(initialPixel);
+}
+
+void benchPolygonChecks(Bench& bench) {
+    for (std::size_t n : { 16u, 64u, 256u, 1024u }) {
+        std::vector<sf::Vector2f> poly = makePolygon(n, { 300.f, 300.f }, 250.f, (unsigned)n);
+        bench.run("isSimplePolygon", "sweep", (long long)n, [&] {
+            g_sink = PrimitiveRenderer::isSimplePolygon(poly);
+        });
+        bench.run("isSimplePolygon", "brute_force", (long long)n, [&] {
+            g_sink = PrimitiveRenderer::isSimplePolygonBruteForce(poly);
+        });
+    }
+}
+
+void benchFills(Bench& bench, PrimitiveRenderer& renderer, TiledRasterizer& tiles) {
+    const sf::Color fill(200, 255, 200);
+    for (unsigned size : { 64u, 256u, 1024u, 2048u }) {
+        const sf::Image source = makeFillImage(size);
+        sf::Image img;
+        auto reset = [&] { img = source; };
+        int seed = (int)size / 2;
+
+        bench.run("boundaryFill", "scanline", size, reset, [&] {
+            renderer.boundaryFill(img, seed, seed, fill, sf::Color::Black);
+        });
+        bench.run("floodFill", "scanline", size, reset, [&] {
+            renderer.floodFill(img, seed, seed, fill);
+        });
+        bench.run("boundaryFill", "queue", size, reset, [&] {
+            renderer.boundaryFillQueue(img, seed, seed, fill, sf::Color::Black);
+        });
+        bench.run("floodFill", "queue", size, reset, [&] {
+            renderer.floodFillQueue(img, seed, seed, fill);
+        });
+        bench.run("boundaryFill", "tiled", size, reset, [&] {
+            tiles.boundaryFill(img, seed, seed, fill, sf::Color::Black);
+        });
+        bench.run("floodFill", "tiled", size, reset, [&] {
+            tiles.floodFill(img, seed, seed, fill);
+        });
+    }
+}
+
+void benchSpriteUpdates(Bench& bench, JobSystem& jobs) {
+    std::shared_ptr<TextureAtlas> atlas = std::make_shared<TextureAtlas>();
+    std::vector<sf::Image> images(4);
+    for (sf::Image& img : images)
+        img.create(32, 48, sf::Color::White);
+    atlas->build(images);
+
+    for (std::size_t n : { 1000u, 10000u, 100000u }) {
+        Registry registry;
+        std::vector<sf::IntRect> frames = {
+            { 0, 0, 32, 48 }, { 32, 0, 32, 48 }, { 64, 0, 32, 48 }, { 96, 0, 32, 48 }
+        };
+        for (std::size_t i = 0; i < n; ++i) {
+            Entity e = registry.create();
+            registry.transforms().add(e).position = sf::Vector2f((float)(i % 1000), (float)(i / 1000));
+            registry.velocities().add(e).value = sf::Vector2f(10.f, 5.f);
+            SpriteComponent& sprite = registry.sprites().add(e);
+            sprite.texture = &atlas->texture();
+            sprite.rect = frames[0];
+            AnimationComponent& anim = registry.animations().add(e);
+            anim.frames = frames;
+            anim.timePerFrame = 0.05f;
+        }
+        bench.run("registryUpdate", "serial", (long long)n, [&] {
+            registry.update(1.f / 60.f);
+        });
+        bench.run("registryUpdate", "jobs", (long long)n, [&] {
+            registry.update(1.f / 60.f, jobs);
+        });
+
+        // Frames are picked at submission, so culled sprites cost only
+        // their bounds test.
+        SpriteBatch batch;
+        sf::FloatRect view(0.f, 0.f, 100.f, (float)(n / 1000));
+        bench.run("registrySubmit", "all", (long long)n, [&] { batch.clear(); }, [&] {
+            registry.submitSprites(batch);
+            g_sink = batch.size() != 0;
+        });
+        bench.run("registrySubmit", "culled", (long long)n, [&] { batch.clear(); }, [&] {
+            registry.submitSprites(batch, view);
+            g_sink = batch.size() != 0;
+        });
+
+        std::vector<std::unique_ptr<SpriteObject>> objects;
+        for (std::size_t i = 0; i < n; ++i) {
+            objects.emplace_back(new SpriteObject());
+            objects.back()->setFrames(atlas);
+            objects.back()->setTimePerFrame(0.05f);
+        }
+        bench.run("spriteObjectUpdate", "virtual", (long long)n, [&] {
+            for (auto& obj : objects)
+                obj->update(1.f / 60.f);
+        });
+    }
+}
+
+// Sprites on a few layers and textures in scattered order: recording on
+// one thread or in per-part queues appended in order, then sorting and
+// merging. With a GPU the queue is also submitted.
+void benchRenderQueue(Bench& bench, JobSystem& jobs) {
+    const std::size_t textureCount = 8;
+    std::vector<sf::Texture> textures(textureCount);
+    for (sf::Texture& t : textures)
+        t.create(32, 32);
+
+    for (std::size_t n : { 1000u, 10000u, 100000u }) {
+        struct Quad {
+            const sf::Texture* texture;
+            sf::Transform transform;
+            int layer;
+        };
+        std::mt19937 rng((unsigned)n);
+        std::vector<Quad> quads(n);
+        for (Quad& q : quads) {
+            q.texture = &textures[rng() % textureCount];
+            q.transform.translate((float)(rng() % 1000), (float)(rng() % 1000));
+            q.layer = (int)(rng() % 4);
+        }
+        const sf::IntRect rect(0, 0, 32, 32);
+        auto record = [&](RenderQueue& queue, std::size_t b, std::size_t e) {
+            for (std::size_t i = b; i < e; ++i)
+                queue.add(quads[i].texture, rect, quads[i].transform, sf::Color::White, quads[i].layer);
+        };
+
+        RenderQueue queue;
+        bench.run("renderQueueRecord", "serial", (long long)n, [&] { queue.clear(); }, [&] {
+            record(queue, 0, n);
+        });
+
+        // Fixed parts, so the merged order does not depend on scheduling.
+        std::vector<RenderQueue> parts(jobs.threadCount() * 4);
+        bench.run("renderQueueRecord", "jobs", (long long)n, [&] { queue.clear(); }, [&] {
+            jobs.parallelFor(parts.size(), 1, [&](std::size_t b, std::size_t e) {
+                for (std::size_t p = b; p < e; ++p) {
+                    parts[p].clear();
+                    record(parts[p], n * p / parts.size(), n * (p + 1) / parts.size());
+                }
+            });
+            for (const RenderQueue& part : parts)
+                queue.append(part);
+        });
+
+        queue.clear();
+        record(queue, 0, n);
+        bench.run("renderQueuePrepare", "sort_merge", (long long)n, [&] {
+            g_sink = queue.prepare() != 0;
+        });
+
+        if (bench.gpu()) {
+            sf::RenderTexture target;
+            if (target.create(1024, 1024))
+                bench.run("renderQueueSubmit", "render_texture", (long long)n, [&] {
+                    queue.submit(target);
+                });
+        }
+    }
+}
+
+// Every kernel set the CPU supports, one backend each.
+void benchKernels(Bench& bench) {
+    const PixelKernels::Isa isas[] = { PixelKernels::Isa::Scalar, PixelKernels::Isa::SSE2,
+        PixelKernels::Isa::AVX2, PixelKernels::Isa::NEON };
+    const PixelKernels::Isa initial = PixelKernels::isa();
+
+    for (unsigned size : { 256u, 1024u }) {
+        std::mt19937 rng(size);
+        sf::Image sprite = BitmapHandler::create(size, size);
+        for (unsigned y = 0; y < size; ++y)
+            for (unsigned x = 0; x < size; ++x)
+                sprite.setPixel(x, y, sf::Color(rng() & 255, rng() & 255, rng() & 255, rng() & 255));
+        const sf::Image background = BitmapHandler::create(size, size, sf::Color(40, 80, 120));
+        sf::Image img;
+        auto reset = [&] { img = background; };
+        auto resetSprite = [&] { img = sprite; };
+
+        for (PixelKernels::Isa isa : isas) {
+            if (!PixelKernels::setIsa(isa))
+                continue;
+            const std::string backend = PixelKernels::name(isa);
+            bench.run("blit", backend, size, reset, [&] {
+                BitmapHandler::copy(sprite, img);
+            });
+            bench.run("fillRect", backend, size, reset, [&] {
+                BitmapHandler::fillRect(img, sf::IntRect(0, 0, (int)size, (int)size), sf::Color::Red);
+            });
+            bench.run("colorKey", backend, size, resetSprite, [&] {
+                BitmapHandler::colorKey(img, sprite.getPixel(0, 0));
+            });
+            bench.run("premultiply", backend, size, resetSprite, [&] {
+                BitmapHandler::premultiply(img);
+            });
+        }
+    }
+    PixelKernels::setIsa(initial);
+}
+
+// Startup cost of one texture: mapping a scene file and touching every
+// page of its pixels, against decoding the same image from PNG.
+void benchSceneLoad(Bench& bench) {
+    for (unsigned size : { 256u, 1024u, 2048u }) {
+        std::mt19937 rng(size);
+        sf::Image img = BitmapHandler::create(size, size);
+        for (unsigned y = 0; y < size; ++y)
+            for (unsigned x = 0; x < size; ++x)
+                img.setPixel(x, y, sf::Color(x & 255, y & 255, rng() & 15, 255));
+
+        const std::string scenePath = "bench_scene.s2d";
+        const std::string pngPath = "bench_scene.png";
+        SceneWriter writer;
+        writer.addObject(SceneFile::Kind::Image, "image").texture = writer.addTexture(img);
+        if (!writer.save(scenePath) || !BitmapHandler::saveToFile(pngPath, img)) {
+            std::fprintf(stderr, "bench: could not write scene files, skipping sceneLoad\n");
+            return;
+        }
+
+        bench.run("sceneLoad", "mapped", size, [&] {
+            SceneFile scene;
+            sf::Uint32 sum = 0;
+            if (scene.open(scenePath)) {
+                PixelView pixels = scene.pixels(scene.object(0).texture);
+                const std::size_t count = (std::size_t)pixels.width() * pixels.height();
+                for (std::size_t i = 0; i < count; i += 1024)
+                    sum += pixels.data()[i];
+            }
+            g_sink = (sum & 1) != 0;
+        });
+        bench.run("sceneLoad", "png", size, [&] {
+            sf::Image decoded;
+            g_sink = BitmapHandler::loadFromFile(pngPath, decoded);
+        });
+
+        std::remove(scenePath.c_str());
+        std::remove(pngPath.c_str());
+    }
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc)
+            options.filter = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc)
+            options.minTimeMs = std::atof(argv[++i]);
+        else if (arg == "--csv")
+            options.csv = true;
+        else if (arg == "--no-gpu")
+            options.gpu = false;
+        else {
+            std::fprintf(stderr,
+                "usage: bench [--filter <substring>] [--min-time <ms>] [--csv] [--no-gpu]\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+
+    Bench bench(options);
+    PrimitiveRenderer renderer;
+    renderer.setRasterMode(PrimitiveRenderer::RasterMode::Integer);
+    JobSystem jobs;
+    TiledRasterizer tiles(renderer, jobs);
+
+    // The software framebuffer rasterizes into an sf::Image; only its
+    // upload needs a texture, and that is left out of the timed loop.
+    SoftwareFramebuffer framebuffer;
+    if (framebuffer.create(1024, 1024)) {
+        benchPrimitives(bench, renderer, framebuffer, "software", [] {});
+        benchPrimitives(bench, tiles, framebuffer, "software_tiled", [&] {
+            tiles.flush(framebuffer);
+        });
+        benchRasterModes(bench, renderer, framebuffer);
+    }
+    else
+        std::fprintf(stderr, "bench: could not create the software framebuffer\n");
+
+    if (bench.gpu()) {
+        sf::RenderTexture texture;
+        if (texture.create(1024, 1024)) {
+            renderer.setPixelMode(PrimitiveRenderer::PixelMode::BatchedPerFrame);
+            benchPrimitives(bench, renderer, texture, "render_texture", [&] {
+                renderer.flush(texture);
+            });
+            renderer.setPixelMode(PrimitiveRenderer::PixelMode::Immediate);
+        }
+        else {
+            std::fprintf(stderr, "bench: no render texture, skipping the GPU backend\n");
+        }
+    }
+
+    benchPolygonChecks(bench);
+    benchFills(bench, renderer, tiles);
+    benchSpriteUpdates(bench, jobs);
+    benchRenderQueue(bench, jobs);
+    benchKernels(bench);
+    benchSceneLoad(bench);
+    return 0;
+}
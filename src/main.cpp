@@ -1,687 +1,456 @@
-#include <SFML/Graphics.hpp>
-#include <SFML/Window.hpp>
-#include <SFML/System.hpp>
+#include "Silnik2D.hpp"
 
-#include <cmath>
-#include <vector>
-#include <queue>
-#include <memory>
-#include <algorithm>
-
-class DrawableObject {
-public:
-    virtual ~DrawableObject() = default;
-    virtual void draw(sf::RenderTarget& target) = 0;
-};
-
-class UpdatableObject {
-public:
-    virtual ~UpdatableObject() = default;
-    virtual void update(float dt) = 0;
-};
-
-class TransformableObject {
-public:
-    virtual ~TransformableObject() = default;
-    virtual void translate(float dx, float dy) = 0;
-    virtual void rotate(float angleDeg) = 0;
-    virtual void scale(float sx, float sy) = 0;
-};
-
-class GameObject : public virtual UpdatableObject, public virtual DrawableObject {
-public:
-    virtual ~GameObject() = default;
-};
-
-class ShapeObject : public virtual DrawableObject, public virtual TransformableObject {
-public:
-    virtual ~ShapeObject() = default;
-};
-
-class PrimitiveRenderer;
+class Engine {
+    sf::RenderWindow m_window;
+    PrimitiveRenderer m_renderer;
+    ResourceManager m_resources;
+    AsyncLoader m_loader;
 
-class Point2D : public ShapeObject {
-    sf::Vector2f m_pos;
-    sf::Color    m_color;
-public:
-    Point2D() : m_pos(0.f, 0.f), m_color(sf::Color::White) {}
-    Point2D(float x, float y, sf::Color color = sf::Color::White)
-        : m_pos(x, y), m_color(color) {
-    }
+    JobSystem m_jobs;
+    Registry m_registry;
 
-    float x() const { return m_pos.x; }
-    float y() const { return m_pos.y; }
-    const sf::Vector2f& position() const { return m_pos; }
-    void set(float x, float y) { m_pos = { x, y }; }
+    // Objects with bounds live in m_spatial and are drawn only when they
+    // overlap the view; the rest are drawn every frame.
+    SpatialGrid m_spatial;
+    std::vector<std::shared_ptr<GameObject>> m_objects;
+    std::vector<GameObject*> m_unindexed;
+    std::vector<SpatialObject*> m_visible;
 
-    void setColor(const sf::Color& c) { m_color = c; }
-    sf::Color color() const { return m_color; }
+    std::shared_ptr<Player> m_player;
 
-    void translate(float dx, float dy) override {
-        m_pos.x += dx;
-        m_pos.y += dy;
-    }
+    CollisionWorld m_collisions;
+    CollisionWorld::Body m_playerBody{ -1 };
+    CollisionWorld::Body m_polygonBody{ -1 };
+
+    // Dynamic drawing is recorded here and submitted once per frame;
+    // m_spriteBatch only collects objects that can batch but not record.
+    RenderQueue m_queue;
+    SpriteBatch m_spriteBatch;
+
+    // The scene is mapped from ScenePath; image objects stream straight
+    // from the mapped pixels, so the scene must outlive them.
+    static constexpr const char* ScenePath = "demo.s2d";
+    SceneFile m_scene;
+    std::vector<sf::Uint8> m_sceneBytes;
+    std::vector<std::unique_ptr<StreamingTexture>> m_images;
+
+    SoftwareFramebuffer m_framebuffer;
+    TiledRasterizer m_tiles;
+    bool m_softwareRaster{ false };
+
+    // Lines, curves, the polygon and the fill demos never move, so they are
+    // kept in a retained layer and redrawn only when invalidated.
+    StaticLayer m_staticLayer;
+
+    enum Action {
+        MoveLeft, MoveRight, MoveUp, MoveDown,
+        RotateLeft, RotateRight, Grow, Shrink,
+        ToggleRaster, ToggleProfiler, ToggleTrace, Quit
+    };
+    InputMap m_input;
+
+    Profiler m_profiler;
+    bool m_showProfiler{ false };
+
+    // Transient per-frame scratch, rewound at the top of every frame.
+    FrameArena m_frameArena;
+    sf::Font m_overlayFont;
+    bool m_overlayFontLoaded{ false };
+    bool m_overlayFontTried{ false };
+
+    PolygonShape m_polygon;
+
+    // Fixed-step simulation: update() always sees m_step, and render()
+    // blends registry transforms by the leftover fraction of a step.
+    float m_step{ 1.f / 60.f };
+    float m_accumulator{ 0.f };
+    int m_maxSteps{ 5 };
+
+    // Raster is m_renderer for a render target, or m_tiles for the
+    // software framebuffer.
+    template <typename Raster, typename Target>
+    void drawPrimitives(Raster& raster, Target& target) {
+        sf::Vector2f p3(50.f, 100.f);
+        sf::Vector2f p4(300.f, 200.f);
+        raster.drawLineIncremental(target, p3, p4, sf::Color::Blue);
 
-    void rotate(float angleDeg) override {
-        float rad = angleDeg * 3.14159265359f / 180.f;
-        float cs = std::cos(rad);
-        float sn = std::sin(rad);
-        float nx = m_pos.x * cs - m_pos.y * sn;
-        float ny = m_pos.x * sn + m_pos.y * cs;
-        m_pos.x = nx;
-        m_pos.y = ny;
-    }
+        raster.drawCircle(target,
+            sf::Vector2f(200.f, 300.f),
+            60.f, sf::Color::Black);
 
-    void scale(float sx, float sy) override {
-        m_pos.x *= sx;
-        m_pos.y *= sy;
-    }
+        raster.drawEllipse(target,
+            sf::Vector2f(400.f, 300.f),
+            80.f, 40.f, sf::Color::Black);
 
-    void draw(sf::RenderTarget& target) override {
-        sf::Vertex v(m_pos, m_color);
-        target.draw(&v, 1, sf::Points);
+        raster.fillPolygon(target, m_polygon.vertices(),
+            sf::Color(255, 210, 255));
+        raster.drawRasterized(target, m_polygon.rasterized());
     }
-};
 
-class LineSegment : public ShapeObject {
-    Point2D m_a;
-    Point2D m_b;
-    sf::Color m_color;
-    PrimitiveRenderer* m_renderer;
 public:
-    LineSegment()
-        : m_a(), m_b(), m_color(sf::Color::White), m_renderer(nullptr) {
-    }
-
-    LineSegment(PrimitiveRenderer& renderer,
-        const Point2D& a, const Point2D& b,
-        sf::Color color = sf::Color::White)
-        : m_a(a), m_b(b), m_color(color), m_renderer(&renderer) {
-    }
-
-    const Point2D& a() const { return m_a; }
-    const Point2D& b() const { return m_b; }
-
-    void setRenderer(PrimitiveRenderer& r) { m_renderer = &r; }
+    Engine()
+        : m_window(sf::VideoMode(1000, 700), "Silnik 2D - demo PGK"),
+        m_loader(m_resources),
+        m_tiles(m_renderer, m_jobs) {
+        m_window.setFramerateLimit(60);
+        m_renderer.setPixelMode(PrimitiveRenderer::PixelMode::BatchedPerFrame);
+        m_renderer.setRasterMode(PrimitiveRenderer::RasterMode::Integer);
+        m_renderer.setProfiler(&m_profiler);
+        m_renderer.setFrameArena(&m_frameArena);
 
-    void setColor(const sf::Color& c) { m_color = c; }
+        sf::Vector2u size = m_window.getSize();
+        m_framebuffer.create(size.x, size.y);
+        m_staticLayer.create(size.x, size.y);
 
-    void translate(float dx, float dy) override {
-        m_a.translate(dx, dy);
-        m_b.translate(dx, dy);
+        loadScene(ScenePath);
+        initCollisions();
+        initInput();
     }
 
-    void rotate(float angleDeg) override {
-        m_a.rotate(angleDeg);
-        m_b.rotate(angleDeg);
-    }
-
-    void scale(float sx, float sy) override {
-        m_a.scale(sx, sy);
-        m_b.scale(sx, sy);
-    }
+    bool isOpen() const { return m_window.isOpen(); }
 
-    void draw(sf::RenderTarget& target) override;
-};
+    SpatialGrid& spatial() { return m_spatial; }
 
-class PrimitiveRenderer {
-    static void putPixel(sf::RenderTarget& target, int x, int y, sf::Color color) {
-        sf::Vertex v(sf::Vector2f(static_cast<float>(x),
-            static_cast<float>(y)), color);
-        target.draw(&v, 1, sf::Points);
+    void addObject(const std::shared_ptr<GameObject>& obj) {
+        m_objects.push_back(obj);
+        if (SpatialObject* s = dynamic_cast<SpatialObject*>(obj.get()))
+            s->attach(m_spatial);
+        else
+            m_unindexed.push_back(obj.get());
     }
 
-public:
-    PrimitiveRenderer() = default;
-
-    void drawLineDefault(sf::RenderTarget& target,
-        const sf::Vector2f& a, const sf::Vector2f& b,
-        sf::Color color) {
-        sf::Vertex verts[2] = {
-            sf::Vertex(a, color),
-            sf::Vertex(b, color)
-        };
-        target.draw(verts, 2, sf::Lines);
+    sf::FloatRect viewRect() const {
+        const sf::View& view = m_window.getView();
+        sf::Vector2f size = view.getSize();
+        return sf::FloatRect(view.getCenter() - size / 2.f, size);
     }
 
-    void drawLineIncremental(sf::RenderTarget& target,
-        const sf::Vector2f& a, const sf::Vector2f& b,
-        sf::Color color) {
-        float x0 = a.x;
-        float y0 = a.y;
-        float x1 = b.x;
-        float y1 = b.y;
-
-        float dx = x1 - x0;
-        float dy = y1 - y0;
-
-        if (dx == 0 && dy == 0) {
-            putPixel(target, (int)std::round(x0), (int)std::round(y0), color);
-            return;
-        }
+    // Rates that give no usable step (zero, negative, infinite, NaN) are
+    // ignored and the previous rate stays.
+    void setSimulationRate(float hz) {
+        if (hz > 0.f && std::isfinite(hz))
+            m_step = 1.f / hz;
+    }
+    void setMaxStepsPerFrame(int steps) { m_maxSteps = std::max(steps, 1); }
 
-        bool steep = std::fabs(dy) > std::fabs(dx);
-        if (steep) {
-            std::swap(x0, y0);
-            std::swap(x1, y1);
-            std::swap(dx, dy);
-        }
+    // The demo scene that used to be built at every startup; it is now
+    // written to ScenePath once and mapped on later runs.
+    void buildDefaultScene(SceneWriter& scene) {
+        SceneFile::Object& polygon = scene.addObject(SceneFile::Kind::Polygon, "polygon");
+        polygon.color = PixelView::pack(sf::Color::Magenta);
+        scene.setVertices(polygon, {
+            {100.f, 400.f},
+            {200.f, 450.f},
+            {180.f, 550.f},
+            {60.f, 520.f}
+            });
 
-        if (x0 > x1) {
-            std::swap(x0, x1);
-            std::swap(y0, y1);
-            dx = x1 - x0;
-            dy = y1 - y0;
+        const unsigned W = 32;
+        const unsigned H = 48;
+        std::vector<sf::Image> frames;
+        for (int i = 0; i < 4; ++i) {
+            sf::Image img = BitmapHandler::create(W, H,
+                sf::Color(100 + 30 * i,
+                    100 + 20 * i,
+                    255 - 30 * i));
+            BitmapHandler::drawFrame(img, sf::IntRect(0, 0, W, H),
+                sf::Color::Black);
+            frames.push_back(img);
         }
+        std::int32_t atlas = scene.addAtlas("player", frames);
 
-        float m = (dx == 0) ? 0.f : dy / dx;
-        float y = y0;
-
-        for (int x = (int)std::round(x0); x <= (int)std::round(x1); ++x) {
-            int px = steep ? (int)std::round(y) : x;
-            int py = steep ? x : (int)std::round(y);
-            putPixel(target, px, py, color);
-            y += m;
-        }
-    }
+        SceneFile::Object& player = scene.addObject(SceneFile::Kind::Player, "player");
+        player.x = 200.f;
+        player.y = 400.f;
+        player.atlas = atlas;
+        player.timePerFrame = 0.2f;
 
-    void drawCircle(sf::RenderTarget& target,
-        const sf::Vector2f& center,
-        float R,
-        sf::Color color,
-        unsigned int steps = 64) {
-        const float pi = 3.14159265359f;
-        float x0 = center.x;
-        float y0 = center.y;
-
-        unsigned int localSteps = steps;
-        for (unsigned int i = 0; i <= localSteps; ++i) {
-            float alpha = (pi / 4.f) * (float)i / (float)localSteps;
-            float x = R * std::cos(alpha);
-            float y = R * std::sin(alpha);
-
-            int px[8] = {
-                (int)std::round(x0 + x), (int)std::round(x0 + y),
-                (int)std::round(x0 - x), (int)std::round(x0 - y),
-                (int)std::round(x0 - x), (int)std::round(x0 - y),
-                (int)std::round(x0 + x), (int)std::round(x0 + y)
-            };
-            int py[8] = {
-                (int)std::round(y0 + y), (int)std::round(y0 + x),
-                (int)std::round(y0 + y), (int)std::round(y0 + x),
-                (int)std::round(y0 - y), (int)std::round(y0 - x),
-                (int)std::round(y0 - y), (int)std::round(y0 - x)
-            };
-
-            for (int k = 0; k < 8; ++k) {
-                putPixel(target, px[k], py[k], color);
+        // The fill demos are stored filled.
+        sf::Image boundary = BitmapHandler::create(200, 150, sf::Color::White);
+        sf::Color boundaryColor = sf::Color::Black;
+        BitmapHandler::drawFrame(boundary,
+            sf::IntRect(10, 10, 181, 131), boundaryColor);
+        m_tiles.boundaryFill(boundary, 50, 50,
+            sf::Color(200, 255, 200),
+            boundaryColor);
+        SceneFile::Object& boundaryDemo = scene.addObject(SceneFile::Kind::Image, "boundaryFill");
+        boundaryDemo.x = 700.f;
+        boundaryDemo.y = 50.f;
+        boundaryDemo.texture = scene.addTexture(boundary);
+
+        sf::Image flood = BitmapHandler::create(200, 150, sf::Color(240, 240, 255));
+        BitmapHandler::drawFrame(flood,
+            sf::IntRect(0, 0, 200, 150), sf::Color::Black);
+        m_tiles.floodFill(flood, 100, 75,
+            sf::Color(255, 220, 200));
+        SceneFile::Object& floodDemo = scene.addObject(SceneFile::Kind::Image, "floodFill");
+        floodDemo.x = 700.f;
+        floodDemo.y = 250.f;
+        floodDemo.texture = scene.addTexture(flood);
+    }
+
+    static void place(TransformableObject& obj, const SceneFile::Object& o) {
+        obj.translate(o.x, o.y);
+        obj.rotate(o.rotation);
+        obj.scale(o.scaleX, o.scaleY);
+    }
+
+    // A missing or out-of-date file is rebuilt from the default scene; if
+    // it cannot be written, the scene is used from memory instead.
+    void loadScene(const std::string& path) {
+        if (!m_scene.open(path)) {
+            SceneWriter writer;
+            buildDefaultScene(writer);
+            if (!writer.save(path) || !m_scene.open(path)) {
+                m_sceneBytes = writer.finish();
+                m_scene.open(m_sceneBytes.data(), m_sceneBytes.size());
             }
         }
-    }
 
-    void drawEllipse(sf::RenderTarget& target,
-        const sf::Vector2f& center,
-        float Rx, float Ry,
-        sf::Color color,
-        unsigned int steps = 90) {
-        const float pi = 3.14159265359f;
-        float x0 = center.x;
-        float y0 = center.y;
-
-        for (unsigned int i = 0; i <= steps; ++i) {
-            float alpha = (pi / 2.f) * (float)i / (float)steps;
-            float x = Rx * std::cos(alpha);
-            float y = Ry * std::sin(alpha);
-
-            int px[4] = {
-                (int)std::round(x0 + x),
-                (int)std::round(x0 - x),
-                (int)std::round(x0 + x),
-                (int)std::round(x0 - x)
-            };
-            int py[4] = {
-                (int)std::round(y0 + y),
-                (int)std::round(y0 + y),
-                (int)std::round(y0 - y),
-                (int)std::round(y0 - y)
-            };
-
-            for (int k = 0; k < 4; ++k) {
-                putPixel(target, px[k], py[k], color);
+        for (std::size_t i = 0; i < m_scene.atlasCount(); ++i)
+            m_resources.atlases().declare(m_scene.name(m_scene.atlas(i).name),
+                [this, i](TextureAtlas& atlas) { return m_scene.loadAtlas(i, atlas); }, "startup");
+        m_resources.preload("startup");
+
+        for (std::size_t i = 0; i < m_scene.objectCount(); ++i) {
+            const SceneFile::Object& o = m_scene.object(i);
+            switch (o.kind) {
+            case SceneFile::Kind::Player:
+                m_player = std::make_shared<Player>(m_registry);
+                if (o.atlas >= 0)
+                    m_player->setFrames(m_resources.atlas(m_scene.name(m_scene.atlas(o.atlas).name)));
+                m_player->setTimePerFrame(o.timePerFrame);
+                place(*m_player, o);
+                break;
+            case SceneFile::Kind::Polygon:
+                m_polygon = PolygonShape(m_renderer, m_scene.vertices(o), SceneFile::color(o));
+                place(m_polygon, o);
+                break;
+            case SceneFile::Kind::Image: {
+                if (o.texture < 0)
+                    break;
+                PixelView pixels = m_scene.pixels(o.texture);
+                m_images.emplace_back(new StreamingTexture());
+                m_images.back()->create(pixels.width(), pixels.height());
+                m_images.back()->setSource(pixels);
+                m_images.back()->setPosition(o.x, o.y);
+                break;
             }
-        }
-    }
-
-    static float cross(const sf::Vector2f& a,
-        const sf::Vector2f& b,
-        const sf::Vector2f& c) {
-        return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
-    }
-
-    static bool segmentsIntersect(const sf::Vector2f& a1, const sf::Vector2f& a2,
-        const sf::Vector2f& b1, const sf::Vector2f& b2) {
-        float d1 = cross(a1, a2, b1);
-        float d2 = cross(a1, a2, b2);
-        float d3 = cross(b1, b2, a1);
-        float d4 = cross(b1, b2, a2);
-
-        if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
-            ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) {
-            return true;
-        }
-        return false;
-    }
-
-    bool drawPolygon(sf::RenderTarget& target,
-        const std::vector<sf::Vector2f>& pts,
-        sf::Color color) {
-        if (pts.size() < 3) return false;
-
-        std::size_t n = pts.size();
-        for (std::size_t i = 0; i < n; ++i) {
-            sf::Vector2f a1 = pts[i];
-            sf::Vector2f a2 = pts[(i + 1) % n];
-            for (std::size_t j = i + 1; j < n; ++j) {
-                if (j == i) continue;
-                if ((j + 1) % n == i || (i + 1) % n == j) continue;
-
-                sf::Vector2f b1 = pts[j];
-                sf::Vector2f b2 = pts[(j + 1) % n];
-                if (segmentsIntersect(a1, a2, b1, b2)) {
-                    return false;
-                }
+            default:
+                // Kinds from newer writers.
+                break;
             }
         }
 
-        for (std::size_t i = 0; i < n; ++i) {
-            sf::Vector2f a = pts[i];
-            sf::Vector2f b = pts[(i + 1) % n];
-            drawLineIncremental(target, a, b, color);
-        }
-        return true;
-    }
-
-    void boundaryFill(sf::Image& img,
-        int x, int y,
-        const sf::Color& fillColor,
-        const sf::Color& boundaryColor) {
-        sf::Vector2u size = img.getSize();
-        if (x < 0 || y < 0 || (unsigned)x >= size.x || (unsigned)y >= size.y)
-            return;
-
-        sf::Color start = img.getPixel(x, y);
-        if (start == boundaryColor || start == fillColor)
-            return;
-
-        std::queue<sf::Vector2i> q;
-        q.push({ x, y });
-
-        while (!q.empty()) {
-            sf::Vector2i p = q.front();
-            q.pop();
-
-            if (p.x < 0 || p.y < 0 ||
-                (unsigned)p.x >= size.x || (unsigned)p.y >= size.y)
-                continue;
-
-            sf::Color c = img.getPixel(p.x, p.y);
-            if (c == boundaryColor || c == fillColor)
-                continue;
-
-            img.setPixel(p.x, p.y, fillColor);
-
-            q.push({ p.x + 1, p.y });
-            q.push({ p.x - 1, p.y });
-            q.push({ p.x, p.y + 1 });
-            q.push({ p.x, p.y - 1 });
-        }
-    }
-
-    void floodFill(sf::Image& img,
-        int x, int y,
-        const sf::Color& fillColor) {
-        sf::Vector2u size = img.getSize();
-        if (x < 0 || y < 0 || (unsigned)x >= size.x || (unsigned)y >= size.y)
-            return;
-
-        sf::Color backgroundColor = img.getPixel(x, y);
-        if (backgroundColor == fillColor)
-            return;
-
-        std::queue<sf::Vector2i> q;
-        q.push({ x, y });
-
-        while (!q.empty()) {
-            sf::Vector2i p = q.front();
-            q.pop();
-
-            if (p.x < 0 || p.y < 0 ||
-                (unsigned)p.x >= size.x || (unsigned)p.y >= size.y)
-                continue;
-
-            sf::Color c = img.getPixel(p.x, p.y);
-            if (c != backgroundColor || c == fillColor)
-                continue;
-
-            img.setPixel(p.x, p.y, fillColor);
-
-            q.push({ p.x + 1, p.y });
-            q.push({ p.x - 1, p.y });
-            q.push({ p.x, p.y + 1 });
-            q.push({ p.x, p.y - 1 });
-        }
+        if (!m_player)
+            m_player = std::make_shared<Player>(m_registry);
     }
-};
 
-void LineSegment::draw(sf::RenderTarget& target) {
-    if (m_renderer) {
-        m_renderer->drawLineIncremental(
-            target,
-            m_a.position(),
-            m_b.position(),
-            m_color
-        );
-    }
-    else {
-        sf::Vertex v[2] = {
-            sf::Vertex(m_a.position(), m_color),
-            sf::Vertex(m_b.position(), m_color)
-        };
-        target.draw(v, 2, sf::Lines);
-    }
-}
-
-class BitmapHandler {
-public:
-    static sf::Image create(unsigned width, unsigned height,
-        sf::Color color = sf::Color::Transparent) {
-        sf::Image img;
-        img.create(width, height, color);
-        return img;
+    void initInput() {
+        m_input.bind(MoveLeft, sf::Keyboard::A);
+        m_input.bind(MoveRight, sf::Keyboard::D);
+        m_input.bind(MoveUp, sf::Keyboard::W);
+        m_input.bind(MoveDown, sf::Keyboard::S);
+        m_input.bind(RotateLeft, sf::Keyboard::Q);
+        m_input.bind(RotateRight, sf::Keyboard::E);
+        m_input.bind(Grow, sf::Keyboard::Z);
+        m_input.bind(Shrink, sf::Keyboard::X);
+        m_input.bind(ToggleRaster, sf::Keyboard::F1);
+        m_input.bind(ToggleProfiler, sf::Keyboard::F3);
+        m_input.bind(ToggleTrace, sf::Keyboard::F4);
+        m_input.bind(Quit, sf::Keyboard::Escape);
     }
 
-    static bool loadFromFile(const std::string& filename, sf::Image& img) {
-        return img.loadFromFile(filename);
+    void initCollisions() {
+        m_polygonBody = m_collisions.add();
+        m_collisions.setPolygon(m_polygonBody, m_polygon.vertices());
+        m_playerBody = m_collisions.add(m_player.get());
+        m_collisions.setPolygon(m_playerBody, m_player->corners());
     }
 
-    static bool saveToFile(const std::string& filename, const sf::Image& img) {
-        return img.saveToFile(filename);
-    }
+    Profiler& profiler() { return m_profiler; }
 
-    static void copy(const sf::Image& src, sf::Image& dst,
-        sf::Vector2u dstPos = { 0, 0 }) {
-        dst.copy(src, dstPos.x, dstPos.y, sf::IntRect(), true);
-    }
-};
-
-class BitmapObject : public virtual DrawableObject, public virtual TransformableObject {
-protected:
-    sf::Sprite m_sprite;
-public:
-    virtual ~BitmapObject() = default;
-
-    void setTexture(const sf::Texture& tex) {
-        m_sprite.setTexture(tex);
-    }
-
-    void translate(float dx, float dy) override {
-        m_sprite.move(dx, dy);
-    }
-
-    void rotate(float angleDeg) override {
-        m_sprite.rotate(angleDeg);
-    }
-
-    void scale(float sx, float sy) override {
-        m_sprite.scale(sx, sy);
-    }
-
-    void draw(sf::RenderTarget& target) override {
-        target.draw(m_sprite);
-    }
-
-    sf::Vector2f position() const {
-        return m_sprite.getPosition();
-    }
-};
-
-class AnimatedObject : public virtual UpdatableObject {
-public:
-    virtual ~AnimatedObject() = default;
-    virtual void animate(float dt) = 0;
-};
-
-class SpriteObject : public BitmapObject, public AnimatedObject {
-protected:
-    std::vector<sf::Texture> m_frames;
-    float  m_timePerFrame{ 0.15f };
-    float  m_timeAccumulator{ 0.f };
-    std::size_t m_currentFrame{ 0 };
-
-public:
-    virtual ~SpriteObject() = default;
-
-    void setFrames(const std::vector<sf::Texture>& frames) {
-        m_frames = frames;
-        if (!m_frames.empty()) {
-            m_currentFrame = 0;
-            m_sprite.setTexture(m_frames[0], true);
-        }
-    }
-
-    void setTimePerFrame(float t) { m_timePerFrame = t; }
-
-    void animate(float dt) override {
-        if (m_frames.empty()) return;
-        m_timeAccumulator += dt;
-        if (m_timeAccumulator >= m_timePerFrame) {
-            m_timeAccumulator -= m_timePerFrame;
-            m_currentFrame = (m_currentFrame + 1) % m_frames.size();
-            m_sprite.setTexture(m_frames[m_currentFrame], true);
+    // F3 shows the overlay; labels appear only if the font loads.
+    void toggleProfilerOverlay() {
+        m_showProfiler = !m_showProfiler;
+        if (m_showProfiler && !m_overlayFontTried) {
+            m_overlayFontTried = true;
+            m_overlayFontLoaded = m_overlayFont.loadFromFile("C:/Windows/Fonts/consola.ttf");
         }
     }
 
-    void update(float dt) override {
-        animate(dt);
-    }
-};
-
-class Player : public SpriteObject, public GameObject {
-    sf::Vector2f m_velocity{ 0.f, 0.f };
-    float m_speed{ 150.f };
-public:
-    Player() = default;
-
-    void setVelocity(const sf::Vector2f& v) {
-        m_velocity = v;
-    }
-
-    void update(float dt) override {
-        m_sprite.move(m_velocity * dt);
-        SpriteObject::update(dt);
-    }
-};
-
-class Engine {
-    sf::RenderWindow m_window;
-    PrimitiveRenderer m_renderer;
-
-    std::vector<std::shared_ptr<GameObject>> m_objects;
-
-    std::shared_ptr<Player> m_player;
-
-    sf::Image  m_imgBoundary;
-    sf::Texture m_texBoundary;
-    sf::Sprite  m_sprBoundary;
-
-    sf::Image  m_imgFlood;
-    sf::Texture m_texFlood;
-    sf::Sprite  m_sprFlood;
-
-public:
-    Engine()
-        : m_window(sf::VideoMode(1000, 700), "Silnik 2D - demo PGK") {
-        m_window.setFramerateLimit(60);
-
-        initPlayer();
-        initFillDemos();
-    }
-
-    bool isOpen() const { return m_window.isOpen(); }
-
-    void initPlayer() {
-        const unsigned W = 32;
-        const unsigned H = 48;
-        std::vector<sf::Texture> frames;
-
-        for (int i = 0; i < 4; ++i) {
-            sf::Image img;
-            img.create(W, H, sf::Color(100 + 30 * i,
-                100 + 20 * i,
-                255 - 30 * i));
-            for (unsigned x = 0; x < W; ++x) {
-                img.setPixel(x, 0, sf::Color::Black);
-                img.setPixel(x, H - 1, sf::Color::Black);
-            }
-            for (unsigned y = 0; y < H; ++y) {
-                img.setPixel(0, y, sf::Color::Black);
-                img.setPixel(W - 1, y, sf::Color::Black);
-            }
-
-            sf::Texture tex;
-            tex.loadFromImage(img);
-            frames.push_back(tex);
-        }
-
-        m_player = std::make_shared<Player>();
-        m_player->setFrames(frames);
-        m_player->setTimePerFrame(0.2f);
-        m_player->translate(200.f, 400.f);
-
-        m_objects.push_back(m_player);
-    }
-
-    void initFillDemos() {
-        m_imgBoundary.create(200, 150, sf::Color::White);
-        sf::Color boundaryColor = sf::Color::Black;
-
-        for (unsigned x = 10; x < 190; ++x) {
-            m_imgBoundary.setPixel(x, 10, boundaryColor);
-            m_imgBoundary.setPixel(x, 140, boundaryColor);
-        }
-        for (unsigned y = 10; y < 140; ++y) {
-            m_imgBoundary.setPixel(10, y, boundaryColor);
-            m_imgBoundary.setPixel(190, y, boundaryColor);
-        }
-
-        m_renderer.boundaryFill(m_imgBoundary, 50, 50,
-            sf::Color(200, 255, 200),
-            boundaryColor);
-        m_texBoundary.loadFromImage(m_imgBoundary);
-        m_sprBoundary.setTexture(m_texBoundary);
-        m_sprBoundary.setPosition(700.f, 50.f);
-
-        m_imgFlood.create(200, 150, sf::Color(240, 240, 255));
-        for (unsigned x = 0; x < 200; ++x) {
-            m_imgFlood.setPixel(x, 0, sf::Color::Black);
-            m_imgFlood.setPixel(x, 149, sf::Color::Black);
-        }
-        for (unsigned y = 0; y < 150; ++y) {
-            m_imgFlood.setPixel(0, y, sf::Color::Black);
-            m_imgFlood.setPixel(199, y, sf::Color::Black);
+    // F4 starts a capture; pressing it again writes frame_trace.json.
+    void toggleTraceCapture() {
+        if (!m_profiler.capturing()) {
+            m_profiler.startCapture();
+            return;
         }
-
-        m_renderer.floodFill(m_imgFlood, 100, 75,
-            sf::Color(255, 220, 200));
-        m_texFlood.loadFromImage(m_imgFlood);
-        m_sprFlood.setTexture(m_texFlood);
-        m_sprFlood.setPosition(700.f, 250.f);
+        m_profiler.stopCapture();
+        m_profiler.writeChromeTrace("frame_trace.json");
     }
 
+    // Key events only update m_input; handleInput() reads its state.
     void handleEvents() {
+        ProfileScope scope(&m_profiler, "handleEvents");
+        m_input.beginFrame();
         sf::Event event;
         while (m_window.pollEvent(event)) {
             if (event.type == sf::Event::Closed)
                 m_window.close();
+            else if (event.type == sf::Event::Resized)
+                m_staticLayer.invalidate();
+            else
+                m_input.handleEvent(event);
         }
     }
 
     void handleInput() {
-        sf::Vector2f vel(0.f, 0.f);
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::A))
-            vel.x -= 1.f;
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::D))
-            vel.x += 1.f;
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::W))
-            vel.y -= 1.f;
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::S))
-            vel.y += 1.f;
-
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Q))
+        ProfileScope scope(&m_profiler, "handleInput");
+        if (m_input.pressed(ToggleRaster)) {
+            m_softwareRaster = !m_softwareRaster;
+            m_staticLayer.invalidate();
+        }
+        if (m_input.pressed(ToggleProfiler))
+            toggleProfilerOverlay();
+        if (m_input.pressed(ToggleTrace))
+            toggleTraceCapture();
+
+        sf::Vector2f vel(m_input.axis(MoveLeft, MoveRight), m_input.axis(MoveUp, MoveDown));
+
+        if (m_input.down(RotateLeft))
             m_player->rotate(-1.f);
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::E))
+        if (m_input.down(RotateRight))
             m_player->rotate(1.f);
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Z))
+        if (m_input.down(Grow))
             m_player->scale(1.001f, 1.001f);
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::X))
+        if (m_input.down(Shrink))
             m_player->scale(0.999f, 0.999f);
 
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Escape))
+        if (m_input.down(Quit))
             m_window.close();
 
         float speed = 150.f;
         m_player->setVelocity(vel * speed);
     }
 
+    // Object updates are independent of each other, so the whole phase is
+    // split across the job system; rendering stays on this thread.
     void update(float dt) {
-        for (auto& obj : m_objects)
-            obj->update(dt);
+        ProfileScope scope(&m_profiler, "update");
+        m_registry.update(dt, m_jobs);
+        m_jobs.parallelFor(m_objects.size(), 64, [&](std::size_t b, std::size_t e) {
+            for (std::size_t i = b; i < e; ++i)
+                m_objects[i]->update(dt);
+        });
+
+        ProfileScope collisions(&m_profiler, "collisions");
+        m_collisions.setPolygon(m_playerBody, m_player->corners());
+        m_collisions.detect();
     }
 
-    void render() {
-        m_window.clear(sf::Color(220, 220, 220));
+    // Call after changing anything renderStatic() draws.
+    void invalidateStatic() { m_staticLayer.invalidate(); }
 
+    void renderStatic(sf::RenderTarget& target) {
         sf::Vector2f p1(50.f, 50.f);
         sf::Vector2f p2(300.f, 100.f);
-        m_renderer.drawLineDefault(m_window, p1, p2, sf::Color::Red);
-
-        sf::Vector2f p3(50.f, 100.f);
-        sf::Vector2f p4(300.f, 200.f);
-        m_renderer.drawLineIncremental(m_window, p3, p4, sf::Color::Blue);
-
-        m_renderer.drawCircle(m_window,
-            sf::Vector2f(200.f, 300.f),
-            60.f, sf::Color::Black);
-
-        m_renderer.drawEllipse(m_window,
-            sf::Vector2f(400.f, 300.f),
-            80.f, 40.f, sf::Color::Black);
+        m_renderer.drawLineDefault(target, p1, p2, sf::Color::Red);
+
+        if (m_softwareRaster) {
+            m_framebuffer.clear();
+            drawPrimitives(m_tiles, m_framebuffer);
+            m_tiles.flush(m_framebuffer);
+            m_framebuffer.draw(target);
+            m_profiler.countDraw(4);
+        }
+        else {
+            drawPrimitives(m_renderer, target);
+            m_renderer.flush(target);
+        }
 
-        std::vector<sf::Vector2f> polygon = {
-            {100.f, 400.f},
-            {200.f, 450.f},
-            {180.f, 550.f},
-            {60.f, 520.f}
-        };
-        m_renderer.drawPolygon(m_window, polygon, sf::Color::Magenta);
+        for (const std::unique_ptr<StreamingTexture>& img : m_images)
+            img->draw(target);
+        m_profiler.countDraw(4 * m_images.size(), m_images.size());
+    }
 
-        m_window.draw(m_sprBoundary);
-        m_window.draw(m_sprFlood);
+    void render(float alpha = 1.f) {
+        ProfileScope scope(&m_profiler, "render");
+        const sf::Color background(220, 220, 220);
 
-        for (auto& obj : m_objects)
-            obj->draw(m_window);
+        if (m_staticLayer.ready()) {
+            {
+                ProfileScope rebuild(&m_profiler, "staticLayer");
+                m_staticLayer.update([this](sf::RenderTarget& target) {
+                    renderStatic(target);
+                }, background);
+            }
+            m_staticLayer.draw(m_window);
+            m_profiler.countDraw(4);
+        }
+        else {
+            m_window.clear(background);
+            renderStatic(m_window);
+        }
 
+        m_queue.clear();
+        m_spriteBatch.clear();
+        m_registry.submitSprites(m_queue, viewRect(), alpha);
+
+        m_visible.clear();
+        m_spatial.query(viewRect(), m_visible);
+        // Cell order changes as things move; a proxy id stays fixed while
+        // its object is indexed, so overlapping objects keep their order.
+        // Freed ids are reused, so it is not insertion order.
+        std::sort(m_visible.begin(), m_visible.end(),
+            [](const SpatialObject* a, const SpatialObject* b) { return a->proxy() < b->proxy(); });
+        // Objects that can neither record nor batch draw straight away,
+        // under everything queued.
+        for (SpatialObject* obj : m_visible)
+            if (!obj->record(m_queue) && !obj->submit(m_spriteBatch))
+                obj->draw(m_window);
+        for (GameObject* obj : m_unindexed)
+            if (!obj->record(m_queue) && !obj->submit(m_spriteBatch))
+                obj->draw(m_window);
+        m_spriteBatch.draw(m_queue);
+        m_renderer.flush(m_queue);
+        {
+            ProfileScope submit(&m_profiler, "submit");
+            m_queue.submit(m_window);
+        }
+        m_profiler.countDraw(m_queue.vertexCount(), m_queue.drawCalls());
+        if (m_showProfiler)
+            m_profiler.drawOverlay(m_window, sf::Vector2f(8.f, 8.f),
+                m_overlayFontLoaded ? &m_overlayFont : nullptr);
         m_window.display();
     }
 
     void run() {
         sf::Clock clock;
+        m_registry.storePrevious();
         while (m_window.isOpen()) {
-            float dt = clock.restart().asSeconds();
+            m_frameArena.reset();
+            m_profiler.beginFrame();
+            m_accumulator += clock.restart().asSeconds();
+            {
+                ProfileScope scope(&m_profiler, "uploadPending");
+                m_loader.uploadPending(sf::milliseconds(2));
+            }
             handleEvents();
             handleInput();
-            update(dt);
-            render();
+
+            int steps = 0;
+            while (m_accumulator >= m_step && steps < m_maxSteps) {
+                m_registry.storePrevious();
+                update(m_step);
+                m_accumulator -= m_step;
+                ++steps;
+            }
+            // Too far behind: drop the backlog instead of spiralling.
+            if (m_accumulator >= m_step)
+                m_accumulator = std::fmod(m_accumulator, m_step);
+
+            render(m_accumulator / m_step);
+            m_profiler.endFrame();
         }
     }
 };